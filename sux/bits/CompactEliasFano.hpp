@@ -0,0 +1,265 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2007-2020 Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../support/common.hpp"
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <utility>
+
+namespace sux::bits {
+
+using namespace std;
+using namespace sux;
+
+/** A compact Elias-Fano representation for small monotone sequences.
+ *
+ * EliasFano carries three util::Vector instances (each with a virtual table
+ * pointer, a size and a capacity) and a SimpleSelectZeroHalf inventory, which
+ * make up more than a hundred bytes per instance. When a very large number of
+ * sequences of a few dozen elements must be stored, the header dominates.
+ *
+ * Instances of this class have no virtual bases and a 32-byte header: the number
+ * of elements and the number of words of the upper bits are stored in 32 bits,
+ * and upper and lower bits share a single backing array, which is stored inline
+ * if it fits into `InlineWords` words. There is no selection inventory: zeros
+ * of the upper bits are located by a linear scan, which for small sequences
+ * costs a handful of popcounts. For sequences beyond a few thousand elements
+ * EliasFano should be preferred.
+ *
+ * @tparam InlineWords the number of 64-bit words that are stored in the object itself.
+ */
+
+template <size_t InlineWords = 2> class CompactEliasFano {
+	static_assert(InlineWords >= 1, "At least one inline word is necessary");
+
+	uint64_t num_bits = 0;
+	uint32_t num_ones = 0;
+	uint32_t num_upper_words : 26;
+	uint32_t l : 6;
+	union {
+		uint64_t *heap;
+		uint64_t inline_words[InlineWords];
+	};
+
+	size_t num_lower_words() const { return (uint64_t(num_ones) * l + 63) / 64; }
+
+	size_t num_words() const { return num_upper_words + num_lower_words(); }
+
+	bool is_inline() const { return num_words() <= InlineWords; }
+
+	const uint64_t *upper() const { return is_inline() ? inline_words : heap; }
+
+	const uint64_t *lower() const { return upper() + num_upper_words; }
+
+	uint64_t get_lower(const uint64_t rank) const {
+		if (l == 0) return 0;
+		const uint64_t start = rank * l;
+		return bitread(lower() + start / 64, start % 64, l);
+	}
+
+	// Returns the start of bucket b (the position following the zero of rank b - 1)
+	// and stores in *end its end (the position of the zero of rank b).
+	uint64_t bucket(const uint64_t b, uint64_t *const end) const {
+		const uint64_t *const upper = this->upper();
+		uint64_t start = 0, curr = 0, window = ~upper[0];
+
+		if (b != 0) {
+			uint64_t residual = b - 1;
+			for (;;) {
+				const uint64_t count = nu(window);
+				if (residual < count) break;
+				window = ~upper[++curr];
+				residual -= count;
+			}
+			start = curr * 64 + select64(window, residual) + 1;
+			window &= -1ULL << start % 64;
+			if (start % 64 == 0) window = ~upper[++curr];
+		}
+
+		while (window == 0) window = ~upper[++curr];
+		*end = curr * 64 + rho(window);
+		return start;
+	}
+
+  public:
+	CompactEliasFano() : num_upper_words(0), l(0), inline_words{} {}
+
+	/** Creates a new instance using an explicit, sorted list of elements.
+	 *
+	 *  The list is read only at construction time.
+	 *
+	 * @param begin an iterator to the beginning of the list.
+	 * @param end an iterator to the end of the list.
+	 */
+	template <class t_itr> CompactEliasFano(const t_itr begin, const t_itr end) : num_upper_words(0), l(0), inline_words{} {
+		const uint64_t n = std::distance(begin, end);
+		assert(n <= UINT32_MAX && "Too many elements for a CompactEliasFano");
+		if (n == 0) return;
+
+		num_ones = n;
+		num_bits = *(end - 1) + 1;
+		l = max(0, lambda_safe(num_bits / num_ones));
+
+		const uint64_t upper_bits = num_ones + (num_bits >> l) + 1;
+		assert((upper_bits + 63) / 64 < (1 << 26) && "Too many upper bits for a CompactEliasFano");
+		num_upper_words = (upper_bits + 63) / 64;
+
+		uint64_t *words = inline_words;
+		if (!is_inline()) {
+			heap = static_cast<uint64_t *>(calloc(num_words(), sizeof(uint64_t)));
+			assert(heap != nullptr && "calloc failed");
+			words = heap;
+		}
+
+		uint64_t *const lower = words + num_upper_words;
+		uint64_t i = 0;
+		for (auto it = begin; it != end; ++it, ++i) {
+			const uint64_t upper_pos = (*it >> l) + i;
+			words[upper_pos / 64] |= 1ULL << upper_pos % 64;
+			if (l != 0) bitwrite(lower + i * l / 64, i * l % 64, l, *it & ((1ULL << l) - 1));
+		}
+	}
+
+	~CompactEliasFano() {
+		if (!is_inline()) free(heap);
+	}
+
+	// Delete copy operators
+	CompactEliasFano(const CompactEliasFano &) = delete;
+	CompactEliasFano &operator=(const CompactEliasFano &) = delete;
+
+	// Define move operators
+	CompactEliasFano(CompactEliasFano &&oth) : CompactEliasFano() { swap(*this, oth); }
+
+	CompactEliasFano &operator=(CompactEliasFano &&oth) {
+		swap(*this, oth);
+		return *this;
+	}
+
+	friend void swap(CompactEliasFano &first, CompactEliasFano &second) noexcept {
+		std::swap(first.num_bits, second.num_bits);
+		std::swap(first.num_ones, second.num_ones);
+		const uint32_t num_upper_words = first.num_upper_words, l = first.l;
+		first.num_upper_words = second.num_upper_words;
+		first.l = second.l;
+		second.num_upper_words = num_upper_words;
+		second.l = l;
+		uint64_t words[InlineWords];
+		memcpy(words, first.inline_words, sizeof(words));
+		memcpy(first.inline_words, second.inline_words, sizeof(words));
+		memcpy(second.inline_words, words, sizeof(words));
+	}
+
+	/** Returns the number of elements smaller than the given value.
+	 *
+	 * @param k a value.
+	 * @return the number of elements of the sequence smaller than `k`.
+	 */
+	uint64_t rank(const uint64_t k) const {
+		if (num_ones == 0) return 0;
+		if (k >= num_bits) return num_ones;
+
+		const uint64_t k_shiftr_l = k >> l;
+		uint64_t pos_hi;
+		const uint64_t pos_lo = bucket(k_shiftr_l, &pos_hi);
+
+		const uint64_t k_lower_bits = k & ((1ULL << l) - 1);
+		uint64_t rank = pos_lo - k_shiftr_l;
+		const uint64_t rank_hi = pos_hi - k_shiftr_l;
+		while (rank < rank_hi && get_lower(rank) < k_lower_bits) rank++;
+		return rank;
+	}
+
+	/** Returns the element of given rank.
+	 *
+	 * @param rank a rank smaller than numOnes().
+	 * @return the element of rank `rank`.
+	 */
+	uint64_t get(const uint64_t rank) const {
+		assert(rank < num_ones);
+		const uint64_t *const upper = this->upper();
+		uint64_t residual = rank;
+		for (size_t i = 0;; i++) {
+			const uint64_t count = nu(upper[i]);
+			if (residual < count) return (i * 64 + select64(upper[i], residual) - rank) << l | get_lower(rank);
+			residual -= count;
+		}
+	}
+
+	/** Finds the largest element smaller than or equal to a given value.
+	 *
+	 * @param k a value.
+	 * @param value where the predecessor will be stored, if it exists.
+	 * @return true if `k` has a predecessor.
+	 */
+	bool predecessor(const uint64_t k, uint64_t *const value) const {
+		const uint64_t rank = k >= num_bits ? num_ones : this->rank(k + 1);
+		if (rank == 0) return false;
+		*value = get(rank - 1);
+		return true;
+	}
+
+	/** Returns the number of elements of the sequence. */
+	size_t numOnes() const { return num_ones; }
+
+	/** Returns an estimate of the size in bits of this structure. */
+	uint64_t bitCount() const { return sizeof(*this) * 8 + (is_inline() ? 0 : num_words() * 64); }
+
+	friend std::ostream &operator<<(std::ostream &out, const CompactEliasFano &ef) {
+		const uint32_t l = ef.l, num_upper_words = ef.num_upper_words;
+		out.write(reinterpret_cast<const char *>(&ef.num_bits), sizeof(ef.num_bits));
+		out.write(reinterpret_cast<const char *>(&ef.num_ones), sizeof(ef.num_ones));
+		out.write(reinterpret_cast<const char *>(&num_upper_words), sizeof(num_upper_words));
+		out.write(reinterpret_cast<const char *>(&l), sizeof(l));
+		if (ef.num_ones != 0) out.write(reinterpret_cast<const char *>(ef.upper()), ef.num_words() * sizeof(uint64_t));
+		return out;
+	}
+
+	friend std::istream &operator>>(std::istream &in, CompactEliasFano &ef) {
+		CompactEliasFano temp;
+		uint32_t l, num_upper_words;
+		in.read(reinterpret_cast<char *>(&temp.num_bits), sizeof(temp.num_bits));
+		in.read(reinterpret_cast<char *>(&temp.num_ones), sizeof(temp.num_ones));
+		in.read(reinterpret_cast<char *>(&num_upper_words), sizeof(num_upper_words));
+		in.read(reinterpret_cast<char *>(&l), sizeof(l));
+		temp.num_upper_words = num_upper_words;
+		temp.l = l;
+		if (temp.num_ones != 0) {
+			uint64_t *words = temp.inline_words;
+			if (!temp.is_inline()) words = temp.heap = static_cast<uint64_t *>(malloc(temp.num_words() * sizeof(uint64_t)));
+			in.read(reinterpret_cast<char *>(words), temp.num_words() * sizeof(uint64_t));
+		}
+		swap(ef, temp);
+		return in;
+	}
+};
+
+} // namespace sux::bits
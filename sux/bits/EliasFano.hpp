@@ -30,8 +30,13 @@
 
 #include <sux/bits/Rank.hpp>
 #include <sux/bits/SimpleSelectHalf.hpp>
+#include <sux/bits/LearnedSelectZero.hpp>
+#include <sux/bits/TwoLevelSelectZero.hpp>
 #include <sux/bits/SimpleSelectZeroHalf.hpp>
+#include <sux/util/Interleave.hpp>
 #include <cstdint>
+#include <memory>
+#include <thread>
 #include <vector>
 
 namespace sux::bits {
@@ -39,6 +44,8 @@ namespace sux::bits {
 using namespace std;
 using namespace sux;
 
+class EliasFanoLoader;
+
 /** An implementation of selection and ranking based on the Elias-Fano representation
  * of monotone sequences.
  *
@@ -46,17 +53,51 @@ using namespace sux;
  * positions for the ones in a vector. In every case, the bit vector or the list
  * are not necessary after construction.
  *
- * @tparam AT a type of memory allocation out of sux::util::AllocType.
+ * @tparam AT a type of memory allocation out of sux::util::AllocType; with
+ * sux::util::DYNAMIC, the type of allocation of each instance is chosen at construction time.
+ * @tparam AllowRank whether to build a selectZero structure on the upper bits, which is necessary for rank() and predecessor().
+ * @tparam SZ the selectZero structure on the upper bits: SimpleSelectZeroHalf, or LearnedSelectZero
+ * for elements that are almost uniformly distributed.
  */
 
-template <util::AllocType AT = util::AllocType::MALLOC, bool AllowRank = true> class EliasFano
+template <util::AllocType AT = util::AllocType::MALLOC, bool AllowRank = true, template <util::AllocType> class SZ = SimpleSelectZeroHalf> class EliasFano
 {
 public:
     util::Vector<uint64_t, AT> lower_bits, upper_bits;
-    SimpleSelectZeroHalf<AT> selectz_upper;
+    SZ<AT> selectz_upper;
     uint64_t num_bits, num_ones;
     int l;
+    // Width in bits of the elements in the micro index of tiny instances (0 if none; see build_micro())
+    int micro_width = 0;
     uint64_t lower_l_bits_mask;
+    // Buckets with at least this number of elements have Eytzinger-ordered lower bits (0 if none)
+    uint64_t eytzinger_threshold = 0;
+    // Opt-in structures, allocated only when built, so that instances without them stay small
+    struct Side {
+        // Sequential buckets with at least this number of elements have a skip table (0 if none)
+        uint64_t skip_threshold = 0;
+        // Hash table from the rank of the first element of each bucket with a skip table
+        // to the offset of its first sample, followed by the number of samples (see build_skip_table())
+        util::Vector<uint64_t, AT> skip_directory;
+        // Lower bits of one element out of skip_sample of each bucket with a skip table, packed in l bits
+        util::Vector<uint64_t, AT> skip_samples;
+        // Blocked Bloom filter for contains(), made of blocks of point_filter_block words (empty if none)
+        util::Vector<uint64_t, AT> point_filter;
+
+        Side(util::AllocType alloc_type) : skip_directory(alloc_type), skip_samples(alloc_type), point_filter(alloc_type) {}
+
+        template <class S>
+        Side(const S &oth, util::AllocType alloc_type)
+            : skip_threshold(oth.skip_threshold), skip_directory(oth.skip_directory, alloc_type), skip_samples(oth.skip_samples, alloc_type),
+              point_filter(oth.point_filter, alloc_type) {}
+    };
+    // Null if there are no skip tables and no point filter
+    std::unique_ptr<Side> side;
+    static constexpr int log2_skip_sample = 4;
+    static constexpr uint64_t skip_sample = 1 << log2_skip_sample;
+    static constexpr uint64_t point_filter_block = 8;
+    // The largest number of elements of the micro index with 16 and 32 bits, that is, in two cache lines
+    static constexpr uint64_t micro_threshold16 = 64, micro_threshold32 = 32;
 
     __inline static void set(util::Vector<uint64_t, AT> &bits, const uint64_t pos)
     { bits[pos / 64] |= 1ULL << pos % 64; }
@@ -93,6 +134,37 @@ public:
         }
     }
 
+private:
+    friend class EliasFanoLoader;
+
+    void init(const uint64_t num_ones, const uint64_t num_bits, const util::AllocType alloc_type)
+    {
+        this->num_ones = num_ones;
+        this->num_bits = num_bits;
+        l = num_ones == 0 ? 0 : max(0, lambda_safe(num_bits / num_ones));
+        lower_l_bits_mask = (1ULL << l) - 1;
+        eytzinger_threshold = 0;
+        side.reset();
+
+#ifdef DEBUG
+        printf("Number of ones: %lld l: %d\n", num_ones, l);
+        printf("Upper bits: %lld\n", num_ones + (num_bits >> l) + 1);
+        printf("Lower bits: %lld\n", num_ones * l);
+#endif
+
+        lower_bits = util::Vector<uint64_t, AT>(alloc_type);
+        upper_bits = util::Vector<uint64_t, AT>(alloc_type);
+        micro_width = 0;
+        lower_bits.size(lower_words());
+        upper_bits.size(((num_ones + (num_bits >> l) + 1) + 63) / 64);
+    }
+
+    __inline void encode(const uint64_t i, const uint64_t x)
+    {
+        if (l != 0) set_bits(lower_bits, i * l, l, x & lower_l_bits_mask);
+        set(upper_bits, (x >> l) + i);
+    }
+
 public:
 
     EliasFano() = default;
@@ -110,44 +182,108 @@ public:
      * @param begin an iterator to the beginning of the list.
      * @param end an iterator to the end of the list.
      * @param remove_duplicates if true, duplicates in the list are removed. (NOTE: if true, the original list can be modified)
+     * @param alloc_type the type of allocation, which must be AT unless AT is util::DYNAMIC.
      */
     template <class t_itr>
-    EliasFano(const t_itr begin, const t_itr end, bool remove_duplicates = false)
+    EliasFano(const t_itr begin, const t_itr end, bool remove_duplicates = false, util::AllocType alloc_type = util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
     {
         auto last = (remove_duplicates) ? std::unique(begin, end) : end;
 
-        num_ones = std::distance(begin, last);
-        this->num_bits = *(last - 1) + 1;
-        l = num_ones == 0 ? 0 : max(0, lambda_safe(num_bits / num_ones));
+        const uint64_t n = std::distance(begin, last);
+        init(n, n == 0 ? 0 : *(last - 1) + 1, alloc_type);
+
+        size_t i = 0;
+        for (auto it = begin; it < last; ++it) encode(i++, *it);
 
 #ifdef DEBUG
-        printf("Number of ones: %lld l: %d\n", num_ones, l);
-        printf("Upper bits: %lld\n", num_ones + (num_bits >> l) + 1);
-        printf("Lower bits: %lld\n", num_ones * l);
+        printf("First lower: %016llx %016llx %016llx %016llx\n", lower_bits[0], lower_bits[1], lower_bits[2], lower_bits[3]);
+        printf("First upper: %016llx %016llx %016llx %016llx\n", upper_bits[0], upper_bits[1], upper_bits[2], upper_bits[3]);
 #endif
 
-        const uint64_t lower_bits_mask = (1ULL << l) - 1;
+        if constexpr (AllowRank) {
+            build_micro();
+            rebuildInventory();
+        }
+    }
 
-        lower_bits.size((num_ones * l + 63) / 64 + 2 * (l == 0));
-        upper_bits.size(((num_ones + (num_bits >> l) + 1) + 63) / 64);
+    /** Creates a copy of an instance with a different type of memory allocation.
+     *
+     *  The arrays of the given instance are copied (see the converting constructor of
+     *  util::Vector), and the selectZero inventory is copied and bound to the new upper bits
+     *  without being rebuilt. In this way an instance built in MALLOC memory can be moved
+     *  to huge pages for serving without constructing it again.
+     *
+     * @param oth the instance to copy, which might be a view or have mapped lower bits.
+     * @param alloc_type the type of allocation of the copy, which must be AT unless AT is util::DYNAMIC.
+     */
+    template <util::AllocType AT2>
+    explicit EliasFano(const EliasFano<AT2, AllowRank, SZ> &oth, util::AllocType alloc_type = util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
+        : lower_bits(oth.lower_bits, alloc_type), upper_bits(oth.upper_bits, alloc_type), num_bits(oth.num_bits), num_ones(oth.num_ones), l(oth.l),
+          micro_width(oth.micro_width), lower_l_bits_mask(oth.lower_l_bits_mask), eytzinger_threshold(oth.eytzinger_threshold)
+    {
+        if (oth.side) side = std::make_unique<Side>(*oth.side, alloc_type);
+        if constexpr (AllowRank) selectz_upper = SZ<AT>(oth.selectz_upper, &upper_bits, alloc_type);
+    }
 
-        size_t i = 0;
-        for (auto it = begin; it < last; ++it)
-        {
-            if (l != 0) set_bits(lower_bits, i * l, l, *it & lower_bits_mask);
-            set(upper_bits, (*it >> l) + i);
-            ++i;
+    /** Builds an instance incrementally from a nondecreasing stream of elements.
+     *
+     *  The number of elements and their upper bound must be known in advance, but
+     *  the elements are not stored: each one is encoded as soon as it is added.
+     *  Using as upper bound the largest element plus one yields the same instance
+     *  that would be built by EliasFano(const t_itr, const t_itr, bool).
+     */
+    class Builder {
+        EliasFano ef;
+        uint64_t count = 0;
+        uint64_t prev = 0;
+
+    public:
+        /** Creates a new builder.
+         *
+         * @param num_ones the number of elements that will be added.
+         * @param num_bits an upper bound (excluded) for the elements that will be added.
+         * @param alloc_type the type of allocation, which must be AT unless AT is util::DYNAMIC.
+         * @param filter_bits_per_element if nonzero, the elements are also inserted into a
+         *  point filter with this number of bits per element (see pointFilter()).
+         */
+        Builder(const uint64_t num_ones, const uint64_t num_bits, util::AllocType alloc_type = util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE,
+                const uint64_t filter_bits_per_element = 0) {
+            ef.init(num_ones, num_bits, alloc_type);
+            ef.init_point_filter(filter_bits_per_element);
         }
 
-#ifdef DEBUG
-        printf("First lower: %016llx %016llx %016llx %016llx\n", lower_bits[0], lower_bits[1], lower_bits[2], lower_bits[3]);
-        printf("First upper: %016llx %016llx %016llx %016llx\n", upper_bits[0], upper_bits[1], upper_bits[2], upper_bits[3]);
-#endif
+        /** Adds an element, which must not be smaller than the previous one. */
+        void add(const uint64_t x) {
+            assert(count < ef.num_ones && x < ef.num_bits && x >= prev);
+            ef.encode(count++, prev = x);
+            if (ef.has_point_filter()) ef.point_filter_add(x);
+        }
 
-        if constexpr (AllowRank)
-            selectz_upper = SimpleSelectZeroHalf(&upper_bits, num_ones + (num_bits >> l));
+        /** Returns the number of elements added so far. */
+        uint64_t size() const { return count; }
 
-        lower_l_bits_mask = (1ULL << l) - 1;
+        /** Returns the instance built; all elements must have been added. */
+        EliasFano build() {
+            assert(count == ef.num_ones);
+            if constexpr (AllowRank) {
+                ef.build_micro();
+                ef.rebuildInventory();
+            }
+            return std::move(ef);
+        }
+    };
+
+    /** Builds again the selectZero inventory from the upper bits.
+     *
+     *  This method is useful when the upper bits have been loaded without the inventory,
+     *  which can be then rebuilt in parallel with other I/O (see EliasFanoLoader).
+     *  Tiny instances, whose queries are answered by the micro index, get an empty inventory.
+     */
+    void rebuildInventory() {
+        if (micro_width != 0)
+            selectz_upper = SZ<AT>();
+        else // The last zero terminates the last bucket, so it must be indexed, too
+            selectz_upper = SZ<AT>(&upper_bits, num_ones + (num_bits >> l) + 1, upper_bits.allocType());
     }
 
     uint64_t rank(const size_t k) const
@@ -156,6 +292,9 @@ public:
 
         if (num_ones == 0) return 0;
         if (k >= num_bits) return num_ones;
+        if (micro_width != 0) return micro_rank(k);
+        // The backward scan below does not use skip tables, and assumes sequential lower bits
+        if (eytzinger_threshold != 0 || (side && side->skip_threshold != 0)) return rankv2(k);
 #ifdef DEBUG
         printf("Ranking %lld...\n", k);
 #endif
@@ -186,6 +325,7 @@ public:
     {
         if (num_ones == 0) return 0;
         if (k >= num_bits) return num_ones;
+        if (micro_width != 0) return micro_rank(k);
 
         const uint64_t k_shiftr_l = k >> l;
 
@@ -194,81 +334,904 @@ public:
         if (k_shiftr_l != 0)
             pos_lo = selectz_upper.selectZero(k_shiftr_l - 1) + 1;
 
-        size_t pos;
-        size_t rank;
-        auto count = pos_hi - pos_lo;
+        const uint64_t rank_lo = pos_lo - k_shiftr_l;
+        return rank_lo + bucket_search<true>(rank_lo, pos_hi - pos_lo, k & lower_l_bits_mask);
+    }
 
-        if (count < 8) {
-            pos = pos_hi;
-            rank = pos_hi - k_shiftr_l;
-            uint64_t rank_times_l = rank * l;
-            const uint64_t k_lower_bits = k & lower_l_bits_mask;
-            do
-            {
-                rank--;
-                rank_times_l -= l;
-                pos--;
-            } while (pos >= pos_lo && (upper_bits[pos / 64] & 1ULL << pos % 64) &&
-                     get_bits(lower_bits, rank_times_l, l) >= k_lower_bits);
+    /** Returns an upper bound on the number of elements in a closed range,
+     *  using only the upper bits.
+     *
+     *  The result is the number of elements whose bucket (that is, whose value
+     *  shifted right by the number of lower bits) intersects the range; thus,
+     *  it overestimates the exact count by at most the size of the first and
+     *  of the last bucket involved. The lower bits are never accessed.
+     *
+     * @param lo the lower end of the range (included).
+     * @param hi the upper end of the range (included).
+     * @return an upper bound on the number of elements in [`lo`..`hi`].
+     */
+    uint64_t estimateCount(const size_t lo, const size_t hi) const {
+        static_assert(AllowRank, "Cannot call estimateCount() if AllowRank is false");
+        if (num_ones == 0 || lo > hi || lo >= num_bits) return 0;
+
+        const uint64_t lo_shiftr_l = lo >> l;
+        const uint64_t hi_shiftr_l = min(hi, num_bits - 1) >> l;
+        if (micro_width != 0) return micro_rank((hi_shiftr_l + 1) << l) - micro_rank(lo_shiftr_l << l);
+
+        const uint64_t end = selectz_upper.selectZero(hi_shiftr_l) - hi_shiftr_l;
+        if (lo_shiftr_l == 0) return end;
+        return end - (selectz_upper.selectZero(lo_shiftr_l - 1) + 1 - lo_shiftr_l);
+    }
+
+    /** Computes estimateCount(const size_t, const size_t) for a batch of ranges.
+     *
+     * @param lo the lower ends of the ranges (included).
+     * @param hi the upper ends of the ranges (included).
+     * @param n the number of ranges.
+     * @param dest an array of `n` elements that will be filled with the estimates.
+     */
+    void estimateCount(const uint64_t *const lo, const uint64_t *const hi, const size_t n, uint64_t *const dest) const {
+        for (size_t i = 0; i < n; i++) dest[i] = estimateCount(lo[i], hi[i]);
+    }
+
+    /** Counts the elements in each of a sequence of sorted, nonoverlapping closed ranges.
+     *
+     *  All ranges are evaluated in a single forward pass over the upper and lower bits.
+     *  When the next range starts far away from the current position, the
+     *  pass jumps to the right bucket using the selectZero inventory instead of scanning.
+     *
+     * @param lo the lower ends of the ranges (included), in increasing order.
+     * @param hi the upper ends of the ranges (included); `hi[i]` must be smaller than `lo[i + 1]`.
+     * @param n the number of ranges.
+     * @param dest an array of `n` elements that will be filled with the counts.
+     */
+    void countRanges(const uint64_t *const lo, const uint64_t *const hi, const size_t n, uint64_t *const dest) const {
+        static_assert(AllowRank, "Cannot call countRanges() if AllowRank is false");
+        sweep<true>(lo, hi, n, dest);
+    }
+
+    /** Checks the emptiness of each of a sequence of sorted, nonoverlapping closed ranges.
+     *
+     *  This method works like countRanges(), but it stops scanning a range as
+     *  soon as an element is found.
+     *
+     * @param lo the lower ends of the ranges (included), in increasing order.
+     * @param hi the upper ends of the ranges (included); `hi[i]` must be smaller than `lo[i + 1]`.
+     * @param n the number of ranges.
+     * @param dest an array of `n` elements that will be filled with true if the corresponding range is empty.
+     */
+    void emptyRanges(const uint64_t *const lo, const uint64_t *const hi, const size_t n, bool *const dest) const {
+        static_assert(AllowRank, "Cannot call emptyRanges() if AllowRank is false");
+        sweep<false>(lo, hi, n, dest);
+    }
+
+    /** Returns whether a value is an element of the sequence.
+     *
+     *  If a point filter has been built (see pointFilter()), it is probed first, so that
+     *  most negative probes do not access the upper and lower bits.
+     *
+     * @param k a value.
+     * @return true if `k` is an element of the sequence.
+     */
+    bool contains(const uint64_t k) const {
+        static_assert(AllowRank, "Cannot call contains() if AllowRank is false");
+        if (k >= num_bits) return false;
+        if (micro_width != 0) {
+            const uint64_t r = micro_rank(k);
+            return r < num_ones && micro_at(r) == k - micro()[0];
+        }
+        if (has_point_filter() && !point_filter_contains(k)) return false;
+
+        const uint64_t k_shiftr_l = k >> l;
+        uint64_t pos_hi, pos_lo = 0;
+        if (k_shiftr_l == 0) {
+            pos_hi = selectz_upper.selectZero(k_shiftr_l);
         } else {
-            auto rank_lo = pos_lo - k_shiftr_l;
-            auto rank_hi = pos_hi - k_shiftr_l;
-            const uint64_t k_lower_bits = k & lower_l_bits_mask;
-
-            while (count > 0)
-            {
-                auto step = count / 2;
-                auto mid = rank_lo + step;
-                if (get_bits(lower_bits, mid * l, l) < k_lower_bits)
-                {
-                    rank_lo = mid + 1;
-                    count -= step + 1;
+            pos_lo = selectz_upper.selectZero(k_shiftr_l - 1, &pos_hi) + 1;
+        }
+
+        const uint64_t rank_lo = pos_lo - k_shiftr_l, count = pos_hi - pos_lo, k_lower_bits = k & lower_l_bits_mask;
+        const uint64_t c = bucket_search<true>(rank_lo, count, k_lower_bits);
+        return c < count && lower_at(rank_lo + c, pos_lo + c) == k_lower_bits;
+    }
+
+    /** Prefetches the memory that a query for a value is likely to access first.
+     *
+     *  This method prefetches the block of the point filter of `k`, if any, and the
+     *  selectZero inventory entry of the bucket of `k`, which all queries read before the upper
+     *  and lower bits. Issuing prefetches for a group of queries before running them
+     *  overlaps their first cache misses.
+     *
+     * @param k a value.
+     */
+    void prefetch(const uint64_t k) const {
+        static_assert(AllowRank, "Cannot call prefetch() if AllowRank is false");
+        if (num_ones == 0 || k >= num_bits) return;
+        if (micro_width != 0) {
+            __builtin_prefetch(micro());
+            return;
+        }
+        if (has_point_filter()) {
+            const util::Vector<uint64_t, AT> &point_filter = side->point_filter;
+            __builtin_prefetch(&point_filter + remap128(point_filter_hash(k), point_filter.size() / point_filter_block) * point_filter_block);
+        }
+        selectz_upper.prefetch(k >> l);
+    }
+
+    /** Builds a point filter for contains().
+     *
+     *  Most point probes into a sparse sequence are negative, but contains() needs
+     *  two selectZero operations and a search in the lower bits to rule a value out.
+     *  This method inserts all elements into a blocked Bloom filter: each element
+     *  selects by hashing a 512-bit block (the size of a cache line) and sets a bit
+     *  in each of its eight words, so that a probe reads a single block. With 10 bits per
+     *  element, about 1% of the negative probes pass the filter. Range queries do not use the filter.
+     *
+     *  The filter can also be built while adding elements to a Builder. Its space is included in bitCount().
+     *  Tiny instances answer contains() with their micro index, so they never have a filter.
+     *
+     * @param bits_per_element the number of bits of the filter per element, or zero to remove the filter.
+     */
+    void pointFilter(const uint64_t bits_per_element) {
+        init_point_filter(micro_width != 0 ? 0 : bits_per_element);
+        if (has_point_filter()) for_each_element([&](const uint64_t x) { point_filter_add(x); });
+    }
+
+    /** Sets the layout of the lower bits of large buckets.
+     *
+     *  Binary search over the lower bits of a large bucket jumps unpredictably across memory.
+     *  With this method, the lower bits of buckets with at least `threshold` elements are
+     *  permuted in Eytzinger (BFS) order, so that in-bucket searches in rankv2() and predecessor()
+     *  become a branchless descent in which the next levels are prefetched. Smaller
+     *  buckets keep the sequential layout. Space usage does not change, but decoding
+     *  an element (e.g., during iteration) needs the bounds of its bucket, which are
+     *  found by scanning the upper bits.
+     *
+     *  Instances are built with the sequential layout. The lower bits must not be mapped.
+     *  Tiny instances, which store a micro index in place of the upper and lower bits, are left unchanged.
+     *
+     * @param threshold the minimum number of elements of a bucket with Eytzinger layout, or
+     *  zero for the sequential layout everywhere.
+     */
+    void eytzingerLayout(const uint64_t threshold) {
+        assert(!lower_bits.isMapped() && "Mapped lower bits cannot be permuted");
+        if (micro_width != 0) return;
+        const uint64_t old_threshold = eytzinger_threshold;
+        eytzinger_threshold = threshold;
+        if (l == 0) return;
+
+        const auto eytzinger = [](const uint64_t threshold, const uint64_t n) { return threshold != 0 && n >= threshold; };
+        std::vector<uint64_t> bucket;
+        for_each_bucket([&](const uint64_t rank, const uint64_t n) {
+            if (!eytzinger(old_threshold, n) && !eytzinger(threshold, n)) return;
+            bucket.resize(n);
+            for (uint64_t i = 0; i < n; i++)
+                bucket[i] = get_bits(lower_bits, (rank + (eytzinger(old_threshold, n) ? eytzinger_slot(i + 1, n) - 1 : i)) * l, l);
+            for (uint64_t i = 0; i < n; i++)
+                set_bits(lower_bits, (rank + (eytzinger(threshold, n) ? eytzinger_slot(i + 1, n) - 1 : i)) * l, l, bucket[i]);
+        });
+
+        // Skip tables are built only for sequential buckets
+        if (side && side->skip_threshold != 0) skipTable(side->skip_threshold);
+    }
+
+    /** Builds skip tables for large buckets.
+     *
+     *  Skew or duplicates in the input can create buckets with hundreds of elements,
+     *  making in-bucket searches in rankv2() and predecessor() walk many words of lower bits.
+     *  This method samples the lower bits of one element out of 16 of each
+     *  bucket with at least `threshold` elements into a small packed side array,
+     *  so that an in-bucket search becomes a search over the samples followed by
+     *  a search over at most 16 elements. Buckets with Eytzinger layout (see eytzingerLayout())
+     *  are not sampled.
+     *
+     *  The samples of a bucket are located through a hash table indexed by the rank of its first element.
+     *  The additional space, which is included in bitCount(), is at most `l` / 16 bits per
+     *  element, plus less than 512 bits per sampled bucket, that is, less than 512 / `threshold` bits per element.
+     *
+     * @param threshold the minimum number of elements of a bucket with a skip table (at least
+     *  2 * 16), or zero to remove all skip tables.
+     */
+    void skipTable(const uint64_t threshold) {
+        assert((threshold == 0 || threshold >= 2 * skip_sample) && "Skip tables need at least two samples");
+        // Tiny instances have no buckets
+        const uint64_t skip_threshold = l == 0 || micro_width != 0 ? 0 : threshold;
+        if (skip_threshold == 0 && !side) return;
+        Side &tables = side_tables();
+        tables.skip_threshold = skip_threshold;
+        tables.skip_directory = util::Vector<uint64_t, AT>(tables.skip_directory.allocType());
+        tables.skip_samples = util::Vector<uint64_t, AT>(tables.skip_samples.allocType());
+        if (tables.skip_threshold != 0) build_skip_table(tables);
+        trim_side();
+    }
+
+private:
+    // Returns the side structures, allocating them if necessary.
+    Side &side_tables() {
+        if (!side) side = std::make_unique<Side>(lower_bits.allocType());
+        return *side;
+    }
+
+    // Frees the side structures if they are empty.
+    void trim_side() {
+        if (side && side->skip_threshold == 0 && side->point_filter.size() == 0) side.reset();
+    }
+
+    __inline bool has_point_filter() const { return side && side->point_filter.size() != 0; }
+
+    void init_point_filter(const uint64_t bits_per_element) {
+        const uint64_t bits = num_ones * bits_per_element, block_bits = point_filter_block * 64;
+        if (bits == 0 && !side) return;
+        util::Vector<uint64_t, AT> &point_filter = side_tables().point_filter;
+        point_filter = util::Vector<uint64_t, AT>(point_filter.allocType());
+        point_filter.size((bits + block_bits - 1) / block_bits * point_filter_block);
+        trim_side();
+    }
+
+    // The MurmurHash3 finalizer
+    __inline static uint64_t point_filter_hash(uint64_t x) {
+        x ^= x >> 33;
+        x *= 0xFF51AFD7ED558CCDULL;
+        x ^= x >> 33;
+        x *= 0xC4CEB9FE1A85EC53ULL;
+        return x ^ x >> 33;
+    }
+
+    // The block of a value is chosen by a first hash, and the bits in the words of the
+    // block by consecutive six-bit fields of a second hash.
+    __inline void point_filter_add(const uint64_t x) {
+        const uint64_t h = point_filter_hash(x), bits = point_filter_hash(h);
+        util::Vector<uint64_t, AT> &point_filter = side->point_filter;
+        uint64_t *const block = &point_filter + remap128(h, point_filter.size() / point_filter_block) * point_filter_block;
+        for (uint64_t w = 0; w < point_filter_block; w++) block[w] |= 1ULL << (bits >> 6 * w) % 64;
+    }
+
+    __inline bool point_filter_contains(const uint64_t x) const {
+        const uint64_t h = point_filter_hash(x), bits = point_filter_hash(h);
+        const util::Vector<uint64_t, AT> &point_filter = side->point_filter;
+        const uint64_t *const block = &point_filter + remap128(h, point_filter.size() / point_filter_block) * point_filter_block;
+        uint64_t all = 1;
+        for (uint64_t w = 0; w < point_filter_block; w++) all &= block[w] >> (bits >> 6 * w) % 64;
+        return all;
+    }
+
+    // The number of words of lower_bits containing the lower bits.
+    __inline uint64_t lower_words() const { return (num_ones * l + 63) / 64 + 2 * (l == 0); }
+
+    // The number of words of the micro index.
+    __inline uint64_t micro_words() const { return micro_width == 0 ? 0 : 1 + (num_ones * micro_width + 255) / 256 * 4; }
+
+    // The micro index, which replaces the lower bits of tiny instances.
+    __inline const uint64_t *micro() const { return &lower_bits; }
+
+    // If the elements are few and close enough, replaces the upper and lower bits with a micro index
+    // made of the smallest element followed by the elements minus the smallest one, in micro_width
+    // bits with flipped sign bit, padded to a multiple of 256 bits with the maximum value. The
+    // selectZero inventory and the point filter are then unnecessary.
+    void build_micro() {
+        if (num_ones == 0 || num_ones > micro_threshold16) return;
+        uint64_t elements[micro_threshold16], i = 0;
+        for_each_element([&](const uint64_t x) { elements[i++] = x; });
+        const uint64_t base = elements[0], span = elements[num_ones - 1] - base;
+        if (span < (1ULL << 16)) micro_width = 16;
+        else if (num_ones <= micro_threshold32 && span < (1ULL << 32)) micro_width = 32;
+        else return;
+
+        util::Vector<uint64_t, AT> index(lower_bits.allocType());
+        index.size(micro_words());
+        uint64_t *const m = &index;
+        m[0] = base;
+        memset(m + 1, 0xFF, (micro_words() - 1) * sizeof(uint64_t));
+        for (i = 0; i < num_ones; i++) {
+            if (micro_width == 16) reinterpret_cast<uint16_t *>(m + 1)[i] = elements[i] - base;
+            else reinterpret_cast<uint32_t *>(m + 1)[i] = elements[i] - base;
+        }
+        // Flip the sign bits, so that signed comparisons order the elements correctly
+        for (uint64_t w = 1; w < micro_words(); w++) m[w] ^= micro_width == 16 ? 0x8000800080008000 : 0x8000000080000000;
+        lower_bits = std::move(index);
+        upper_bits = util::Vector<uint64_t, AT>(upper_bits.allocType());
+        init_point_filter(0);
+    }
+
+    // Checks that the sizes of the bit vectors are consistent with the number of
+    // elements and the universe, so that the selectZero inventory can be built.
+    bool valid_sizes() const {
+        if (l < 0 || l > 63 || lower_l_bits_mask != (1ULL << l) - 1) return false;
+        if (num_ones != 0 && l != max(0, lambda_safe(num_bits / num_ones))) return false;
+
+        if (micro_width != 0) {
+            // Tiny instances store just the micro index, which queries read as the smallest
+            // element followed by whole 256-bit vectors, and which is never permuted
+            if (!AllowRank || (micro_width != 16 && micro_width != 32) || num_ones == 0 || num_ones > micro_threshold16) return false;
+            return upper_bits.size() == 0 && lower_bits.size() == micro_words() && eytzinger_threshold == 0;
+        }
+
+        const uint64_t max_bits = upper_bits.size() * 64;
+        if (num_ones > max_bits || (num_bits >> l) > max_bits) return false;
+        const uint64_t upper_length = num_ones + (num_bits >> l) + 1;
+        if (upper_bits.size() != (upper_length + 63) / 64) return false;
+        if (lower_bits.size() != lower_words()) return false;
+
+        // The last bit is the zero terminating the last bucket, and padding must be zero
+        const uint64_t last = upper_bits[upper_bits.size() - 1];
+        return (last & -1ULL << ((upper_length - 1) % 64)) == 0;
+    }
+
+    // Returns whether the vectors of the selectZero inventory are empty.
+    bool empty_inventory() const {
+        bool empty = true;
+        selectz_upper.visit([&](auto &field) {
+            if constexpr (!std::is_integral_v<std::remove_reference_t<decltype(field)>>) empty &= field.size() == 0;
+        });
+        return empty;
+    }
+
+    // Returns the element of given rank minus the smallest element.
+    __inline uint64_t micro_at(const uint64_t rank) const {
+        if (micro_width == 16) return reinterpret_cast<const uint16_t *>(micro() + 1)[rank] ^ 0x8000;
+        return reinterpret_cast<const uint32_t *>(micro() + 1)[rank] ^ 0x80000000;
+    }
+
+    // Returns the position in the (virtual) upper bits of the element of given rank.
+    __inline uint64_t micro_position(const uint64_t rank) const { return ((micro()[0] + micro_at(rank)) >> l) + rank; }
+
+    // Returns the number of elements smaller than k.
+    __inline uint64_t micro_rank(const uint64_t k) const {
+        const uint64_t *const m = micro();
+        if (k <= m[0]) return 0;
+        const uint64_t x = k - m[0];
+        if (x >= 1ULL << micro_width) return num_ones;
+        // Now padding (the maximum value) is never smaller than x
+#ifdef __AVX2__
+        const __m256i *const v = reinterpret_cast<const __m256i *>(m + 1);
+        const size_t n = micro_words() / 4;
+        uint64_t count = 0;
+        if (micro_width == 16) {
+            const __m256i key = _mm256_set1_epi16(int16_t(x ^ 0x8000));
+            for (size_t i = 0; i < n; i++) count += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpgt_epi16(key, _mm256_loadu_si256(v + i))));
+            return count / 2;
+        }
+        const __m256i key = _mm256_set1_epi32(int32_t(x ^ 0x80000000));
+        for (size_t i = 0; i < n; i++) count += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(key, _mm256_loadu_si256(v + i)))));
+        return count;
+#else
+        uint64_t count = 0;
+        for (uint64_t i = 0; i < num_ones; i++) count += micro_at(i) < x;
+        return count;
+#endif
+    }
+
+    // Calls f(x) for each element x, in increasing order.
+    template <class F> void for_each_element(F &&f) const {
+        if (num_ones == 0) return;
+        uint64_t block[256];
+        for (ElementPointer p = first();; ++p) {
+            const size_t n = p.next(block, sizeof block / sizeof *block);
+            for (size_t i = 0; i < n; i++) f(block[i]);
+            if (p.index() + 1 == num_ones) break;
+        }
+    }
+
+    // Returns the positions in the upper bits of the elements with the given (increasing) ranks.
+    std::vector<uint64_t> upper_positions(const std::vector<uint64_t> &ranks) const {
+        std::vector<uint64_t> positions;
+        uint64_t start = 0, ones = 0; // The start of the current scan, and the number of ones before it
+        for (const uint64_t rank : ranks) {
+            // Tiny instances have no upper bits, but the position follows from the element
+            if (micro_width != 0) {
+                positions.push_back(micro_position(rank));
+                continue;
+            }
+            if (AllowRank) {
+                // The last bucket b whose first element has rank at most rank; it starts after b zeros
+                uint64_t lo = 0, hi = num_bits >> l;
+                start = 0;
+                while (lo < hi) {
+                    const uint64_t mid = (lo + hi + 1) / 2, s = selectz_upper.selectZero(mid - 1) + 1;
+                    if (s - mid <= rank) lo = mid, start = s;
+                    else hi = mid - 1;
                 }
+                ones = start - lo;
+            }
+            uint64_t skip = rank - ones;
+            size_t curr = start / 64;
+            uint64_t window = upper_bits[curr] & -1ULL << start % 64;
+            for (uint64_t c; (c = nu(window)) <= skip; window = upper_bits[++curr]) skip -= c;
+            positions.push_back(curr * 64 + select64(window, skip));
+            start = positions.back();
+            ones = rank;
+        }
+        return positions;
+    }
+
+    // Splits the sequence by rank into (at most) the given number of chunks and calls f(t, p, n) for
+    // each chunk t in a separate thread, where p points at the first element of the chunk and n is its length.
+    template <class F> void parallel_chunks(unsigned threads, F &&f) const {
+        if (threads == 0) threads = max(1U, std::thread::hardware_concurrency());
+        // Tiny chunks are not worth a thread
+        threads = max(uint64_t(1), min(uint64_t(threads), num_ones / 65536));
+        if (num_ones == 0) return;
+        std::vector<uint64_t> ranks(threads);
+        for (unsigned t = 0; t < threads; t++) ranks[t] = num_ones * t / threads;
+        const auto positions = upper_positions(ranks);
+
+        std::vector<std::thread> pool;
+        for (unsigned t = 1; t < threads; t++)
+            pool.emplace_back([&, t] { f(t, ElementPointer(ranks[t], positions[t], this), (t + 1 == threads ? num_ones : ranks[t + 1]) - ranks[t]); });
+        f(0U, ElementPointer(0, positions[0], this), (threads == 1 ? num_ones : ranks[1]));
+        for (auto &thread : pool) thread.join();
+    }
+
+    // Calls f(rank, n) for each bucket, where rank is the rank of the first element and n the number of elements.
+    template <class F> void for_each_bucket(F &&f) const {
+        uint64_t start = 0, rank = 0, buckets = (num_bits >> l) + 1;
+        for (size_t curr = 0; buckets != 0; curr++) {
+            for (uint64_t window = ~upper_bits[curr]; window != 0 && buckets != 0; window &= window - 1, buckets--) {
+                const uint64_t end = curr * 64 + __builtin_ctzll(window), n = end - start;
+                f(rank, n);
+                rank += n;
+                start = end + 1;
+            }
+        }
+    }
+
+    __inline bool uses_skip_table(const uint64_t threshold, const uint64_t n) const {
+        return threshold != 0 && n >= threshold && (eytzinger_threshold == 0 || n < eytzinger_threshold);
+    }
+
+    // The initial slot of a rank in the skip directory, which has a power of two (larger than one) of slots.
+    __inline static uint64_t skip_hash(const uint64_t rank, const uint64_t slots) { return rank * 0x9E3779B97F4A7C15ULL >> (__builtin_clzll(slots) + 1); }
+
+    // Builds the skip tables. The directory is an open-addressing hash table with linear
+    // probing mapping the rank of the first element of each bucket with a skip table to the
+    // offset of its samples: slots are pairs (rank, offset), with rank UINT64_MAX for empty
+    // slots, and the last word is the total number of samples.
+    void build_skip_table(Side &tables) const {
+        util::Vector<uint64_t, AT> &directory = tables.skip_directory, &samples = tables.skip_samples;
+        std::vector<std::pair<uint64_t, uint64_t>> buckets;
+        uint64_t num_samples = 0;
+        for_each_bucket([&](const uint64_t rank, const uint64_t n) {
+            if (uses_skip_table(tables.skip_threshold, n)) {
+                buckets.emplace_back(rank, n);
+                num_samples += (n + skip_sample - 1) / skip_sample;
+            }
+        });
+
+        const uint64_t slots = buckets.empty() ? 0 : 1ULL << (64 - __builtin_clzll(buckets.size() * 2 - 1));
+        directory.size(2 * slots + 1);
+        samples.size((num_samples * l + 63) / 64);
+        for (uint64_t i = 0; i < slots; i++) directory[2 * i] = UINT64_MAX;
+        directory[2 * slots] = num_samples;
+
+        uint64_t offset = 0;
+        for (const auto &[rank, n] : buckets) {
+            uint64_t i = skip_hash(rank, slots);
+            while (directory[2 * i] != UINT64_MAX) i = (i + 1) & (slots - 1);
+            directory[2 * i] = rank;
+            directory[2 * i + 1] = offset;
+            for (uint64_t j = 0; j < n; j += skip_sample) set_bits(samples, offset++ * l, l, get_bits(lower_bits, (rank + j) * l, l));
+        }
+    }
+
+    // Returns the position (from 1) in Eytzinger order of the element of
+    // given in-order position (from 1) of a complete binary tree with n nodes.
+    __inline static uint64_t eytzinger_slot(const uint64_t i, const uint64_t n) {
+        const int h = 64 - __builtin_clzll(n); // Number of levels
+        const uint64_t m = n - ((1ULL << (h - 1)) - 1); // Nodes on the last level
+        if (i <= 2 * m) return ((1ULL << h) + i) >> (__builtin_ctzll(i) + 1);
+        const uint64_t j = i - m; // In-order position in the tree without the last level
+        return ((1ULL << (h - 1)) + j) >> (__builtin_ctzll(j) + 1);
+    }
+
+    // The inverse of eytzinger_slot().
+    __inline static uint64_t eytzinger_inorder(const uint64_t e, const uint64_t n) {
+        const int h = 64 - __builtin_clzll(n);
+        const uint64_t m = n - ((1ULL << (h - 1)) - 1);
+        const int d = 63 - __builtin_clzll(e); // Depth
+        const uint64_t offset = 2 * (e - (1ULL << d)) + 1;
+        if (d == h - 1) return offset;
+        const uint64_t j = offset << (h - 2 - d);
+        return j <= m ? 2 * j : j + m;
+    }
+
+    // Returns the lower bits of the element of given rank, whose one is at position pos of the upper bits.
+    __inline uint64_t lower_at(const uint64_t rank, const uint64_t pos) const {
+        if (eytzinger_threshold == 0) return get_bits(lower_bits, rank * l, l);
+
+        // Bounds of the bucket: the zeros surrounding pos
+        auto curr = pos / 64;
+        uint64_t window = ~upper_bits[curr] & ((1ULL << pos % 64) - 1);
+        while (window == 0 && curr != 0) window = ~upper_bits[--curr];
+        const uint64_t start = window == 0 ? 0 : curr * 64 + 64 - __builtin_clzll(window);
+        curr = pos / 64;
+        window = ~upper_bits[curr] & -2ULL << pos % 64;
+        while (window == 0) window = ~upper_bits[++curr];
+        const uint64_t n = curr * 64 + __builtin_ctzll(window) - start;
+
+        if (n < eytzinger_threshold) return get_bits(lower_bits, rank * l, l);
+        const uint64_t i = pos - start;
+        return get_bits(lower_bits, (rank - i + eytzinger_slot(i + 1, n) - 1) * l, l);
+    }
+
+    // Computes the rank and the position in the upper bits of the predecessor of k, given the bucket of k.
+    void predecessor_in_bucket(const uint64_t k, const uint64_t pos_lo, const uint64_t pos_hi, size_t &rank, int64_t &pos) const {
+        const uint64_t k_shiftr_l = k >> l;
+        // The number of elements of the bucket smaller than or equal to k
+        const uint64_t count = bucket_search<false>(pos_lo - k_shiftr_l, pos_hi - pos_lo, k & lower_l_bits_mask);
+        pos = pos_lo + count - 1;
+        rank = pos_lo - k_shiftr_l + count - 1;
+
+        if (rank == SIZE_MAX) {
+            // k is smaller than all elements
+            pos = -1;
+        } else if (pos > 0 && (upper_bits[pos / 64] & 1ULL << pos % 64) == 0) {
+            // find previous set bit
+            auto curr = pos / 64;
+            uint64_t word = upper_bits[curr] & ((1ULL << pos % 64) - 1);
+            while (word == 0) word = upper_bits[--curr];
+            pos = curr * 64 + 63 - __builtin_clzll(word);
+        }
+    }
+
+    // Returns the number of elements of a bucket whose lower bits are smaller than
+    // (Strict) or smaller than or equal to (!Strict) x.
+    template <bool Strict> __inline uint64_t bucket_search(const uint64_t rank_lo, uint64_t count, const uint64_t x) const {
+        if (eytzinger_threshold != 0 && count >= eytzinger_threshold) {
+            const uint64_t n = count;
+            uint64_t e = 1;
+            while (e <= n) {
+                // Four levels below, the descendants of e are contiguous
+                __builtin_prefetch(&lower_bits + (rank_lo + min(16 * e, n) - 1) * l / 64);
+                const uint64_t v = get_bits(lower_bits, (rank_lo + e - 1) * l, l);
+                e = 2 * e + (Strict ? v < x : v <= x);
+            }
+            e >>= __builtin_ffsll(~e);
+            return e == 0 ? n : eytzinger_inorder(e, n) - 1;
+        }
+
+        if (side && uses_skip_table(side->skip_threshold, count)) {
+            // Look up the bucket in the directory
+            const util::Vector<uint64_t, AT> &skip_directory = side->skip_directory, &skip_samples = side->skip_samples;
+            const uint64_t slots = skip_directory.size() / 2, samples = (count + skip_sample - 1) / skip_sample;
+            for (uint64_t i = slots == 0 ? 0 : skip_hash(rank_lo, slots), probes = 0; probes < slots; i = (i + 1) & (slots - 1), probes++) {
+                const uint64_t rank = skip_directory[2 * i], offset = skip_directory[2 * i + 1];
+                if (rank == UINT64_MAX) break;
+                if (rank != rank_lo) continue;
+                // Inconsistent tables fall back to a plain search
+                if (offset + samples > skip_directory[2 * slots]) break;
+                const uint64_t t = sequential_search<Strict>(skip_samples, offset, samples, x);
+                if (t == 0) return 0;
+                // The sample of index t - 1 is before x, and that of index t (if any) is not
+                const uint64_t from = (t - 1) * skip_sample + 1;
+                return from + sequential_search<Strict>(lower_bits, rank_lo + from, min(count - from, skip_sample - 1), x);
+            }
+        }
+
+        return sequential_search<Strict>(lower_bits, rank_lo, count, x);
+    }
+
+    // Returns the number of l-bit values in bits, starting from index from and sorted,
+    // that are smaller than (Strict) or smaller than or equal to (!Strict) x.
+    template <bool Strict> __inline uint64_t sequential_search(const util::Vector<uint64_t, AT> &bits, const uint64_t from, uint64_t count, const uint64_t x) const {
+        if (count < 8) {
+            uint64_t c = 0;
+            for (; c < count; c++) {
+                const uint64_t v = get_bits(bits, (from + c) * l, l);
+                if (Strict ? v >= x : v > x) break;
+            }
+            return c;
+        }
+
+        uint64_t lo = from;
+        while (count > 0) {
+            auto step = count / 2;
+            auto mid = lo + step;
+            const uint64_t v = get_bits(bits, mid * l, l);
+            if (Strict ? v < x : v <= x) {
+                lo = mid + 1;
+                count -= step + 1;
+            } else {
+                count = step;
+            }
+        }
+        return lo - from;
+    }
+
+    // Buckets beyond which sweep() jumps with selectZero instead of counting zeros.
+    static constexpr uint64_t sweep_jump_buckets = 128;
+    // Elements that sweep() steps through before skipping buckets and galloping.
+    static constexpr int sweep_scan_elements = 8;
+
+    // Returns the position of the zero of given rank among the zeros of the upper bits from pos on.
+    __inline uint64_t skip_zeros(const uint64_t pos, uint64_t rank) const {
+        auto curr = pos / 64;
+        uint64_t window = ~upper_bits[curr] & -1ULL << pos % 64;
+        for (;;) {
+            const uint64_t count = nu(window);
+            if (rank < count) return curr * 64 + select64(window, rank);
+            rank -= count;
+            window = ~upper_bits[++curr];
+        }
+    }
+
+    // Returns the position of the first one of the upper bits from pos on, which must exist.
+    __inline uint64_t next_one(const uint64_t pos) const {
+        auto curr = pos / 64;
+        uint64_t window = upper_bits[curr] & -1ULL << pos % 64;
+        while (window == 0) window = upper_bits[++curr];
+        return curr * 64 + __builtin_ctzll(window);
+    }
+
+    // Advances the cursor (rank, pos), where pos is the position of the one of
+    // the element of given rank in the upper bits, to the first element greater
+    // than or equal to x; rank becomes num_ones if there is no such element.
+    __inline void sweep_to(const uint64_t x, uint64_t &rank, uint64_t &pos) const {
+        if (x >= num_bits) {
+            rank = num_ones;
+            return;
+        }
+
+        // Most targets are a few elements away, so we first step through the ones
+        const uint64_t x_shiftr_l = x >> l, x_lower_bits = x & lower_l_bits_mask;
+        for (int i = 0; i < sweep_scan_elements; i++) {
+            const uint64_t bucket = pos - rank;
+            if (bucket > x_shiftr_l || (bucket == x_shiftr_l && lower_at(rank, pos) >= x_lower_bits)) return;
+            if (++rank == num_ones) return;
+            pos = next_one(pos + 1);
+        }
+
+        if (pos - rank <= x_shiftr_l) skip_to(x, rank, pos);
+    }
+
+    // The slow path of sweep_to(), for targets that are not a few elements away.
+    void skip_to(const uint64_t x, uint64_t &rank, uint64_t &pos) const {
+        const uint64_t x_shiftr_l = x >> l, x_lower_bits = x & lower_l_bits_mask, bucket = pos - rank;
+
+        uint64_t start;
+        if (bucket < x_shiftr_l) {
+            // Move to the start of the bucket of x, counting zeros word by word, or with selectZero if it is far
+            start = x_shiftr_l - bucket > sweep_jump_buckets ? selectz_upper.selectZero(x_shiftr_l - 1) + 1 : skip_zeros(pos, x_shiftr_l - bucket - 1) + 1;
+            rank = start - x_shiftr_l;
+            if (rank == num_ones) return;
+            if ((upper_bits[start / 64] & 1ULL << start % 64) == 0) {
+                // The bucket of x is empty, so the next element is greater than x
+                pos = next_one(start);
+                return;
+            }
+            pos = start;
+        } else
+            start = x_shiftr_l == 0 ? 0 : selectz_upper.selectZero(x_shiftr_l - 1) + 1;
+
+        // Now the cursor is inside the bucket of x, whose end we find with a selection,
+        // as selectZero(rank, &next) would scan the whole bucket to find the next zero
+        const uint64_t end = selectz_upper.selectZero(x_shiftr_l);
+
+        if (eytzinger_threshold != 0 && end - start >= eytzinger_threshold) {
+            const uint64_t rank_lo = start - x_shiftr_l;
+            rank = rank_lo + bucket_search<true>(rank_lo, end - start, x_lower_bits);
+        } else {
+            // Gallop from the cursor on the rest of the bucket, and finish with a binary search
+            const uint64_t n = end - pos;
+            if (get_bits(lower_bits, rank * l, l) >= x_lower_bits) return;
+            uint64_t lo = 0, step = 1;
+            while (lo + step < n && get_bits(lower_bits, (rank + lo + step) * l, l) < x_lower_bits) {
+                lo += step;
+                step *= 2;
+            }
+            const uint64_t hi = min(lo + step, n);
+            rank += lo + 1 + sequential_search<true>(lower_bits, rank + lo + 1, hi - lo - 1, x_lower_bits);
+        }
+
+        pos = start + (rank - (start - x_shiftr_l));
+        // If no element of the bucket is greater than or equal to x, pos is the zero terminating it
+        if (pos == end && rank != num_ones) pos = next_one(end);
+    }
+
+    template <bool Count, typename T> void sweep(const uint64_t *const lo, const uint64_t *const hi, const size_t n, T *const dest) const {
+        if (micro_width != 0) {
+            for (size_t i = 0; i < n; i++) {
+                const uint64_t count = (hi[i] >= num_bits - 1 ? num_ones : micro_rank(hi[i] + 1)) - micro_rank(lo[i]);
+                if constexpr (Count) dest[i] = count;
+                else dest[i] = count == 0;
+            }
+            return;
+        }
+
+        uint64_t rank = 0, pos = 0;
+        if (num_ones != 0)
+            while ((upper_bits[pos / 64] & 1ULL << pos % 64) == 0) pos++;
+
+        for (size_t i = 0; i < n; i++) {
+            if (rank < num_ones) sweep_to(lo[i], rank, pos);
+            if (rank == num_ones) {
+                dest[i] = Count ? 0 : 1;
+                continue;
+            }
+
+            if constexpr (Count) {
+                const uint64_t from = rank;
+                if (hi[i] >= num_bits - 1)
+                    rank = num_ones;
                 else
-                {
-                    count = step;
-                }
+                    sweep_to(hi[i] + 1, rank, pos);
+                dest[i] = rank - from;
+            } else {
+                dest[i] = ((pos - rank) << l | lower_at(rank, pos)) > hi[i];
             }
-            --rank_lo;
-            pos = pos_hi - (rank_hi - rank_lo);
-            rank = rank_lo;
         }
-        return ++rank;
     }
 
+public:
     struct ElementPointer {
         size_t rank;
         size_t pos_upper;
-        const EliasFano<AT, AllowRank> *ef;
+        const EliasFano *ef;
 
-        ElementPointer(size_t rank, size_t pos_upper, const EliasFano<AT, AllowRank> *ef)
+        ElementPointer(size_t rank, size_t pos_upper, const EliasFano *ef)
             : rank(rank), pos_upper(pos_upper), ef(ef) {}
 
 
         uint64_t operator*() const {
-            return (pos_upper - rank) << ef->l | get_bits(ef->lower_bits, rank * ef->l, ef->l);
+            if (ef->micro_width != 0) return ef->micro()[0] + ef->micro_at(rank);
+            return (pos_upper - rank) << ef->l | ef->lower_at(rank, pos_upper);
         }
 
         size_t index() const { return rank; }
 
         ElementPointer& operator++() {
             rank++;
+            if (ef->micro_width != 0) {
+                pos_upper = ef->micro_position(rank);
+                return *this;
+            }
             auto curr = pos_upper / 64;
-            uint64_t window = ef->upper_bits[curr] & -1ULL << pos_upper;
+            uint64_t window = ef->upper_bits[curr] & -1ULL << pos_upper % 64;
             window &= window - 1;
             while (window == 0) window = ef->upper_bits[++curr];
             pos_upper = curr * 64 + __builtin_ctzll(window);
             return *this;
         }
+
+        /** Moves to the previous element; the behavior is undefined if index() is zero. */
+        ElementPointer& operator--() {
+            rank--;
+            if (ef->micro_width != 0) {
+                pos_upper = ef->micro_position(rank);
+                return *this;
+            }
+            auto curr = pos_upper / 64;
+            uint64_t window = ef->upper_bits[curr] & ((1ULL << pos_upper % 64) - 1);
+            while (window == 0) window = ef->upper_bits[--curr];
+            pos_upper = curr * 64 + 63 - __builtin_clzll(window);
+            return *this;
+        }
+
+        /** Decodes backwards, in descending order, the current element and
+         *  the ones preceding it.
+         *
+         *  Ones of the upper bits are enumerated word by word from the most significant
+         *  end, and the lower bits of each word-sized group are decoded in a row.
+         *  On return, this pointer points at the last element decoded.
+         *
+         * @param dest the destination array.
+         * @param n the maximum number of elements to decode.
+         * @return the number of elements decoded, that is, the minimum between
+         *  `n` and index() + 1.
+         */
+        size_t previous(uint64_t *const dest, const size_t n) {
+            const size_t count = min(n, rank + 1);
+            if (count == 0) return 0;
+            if (ef->micro_width != 0) {
+                for (size_t i = 0; i < count; i++) dest[i] = ef->micro()[0] + ef->micro_at(rank - i);
+                rank -= count - 1;
+                pos_upper = ef->micro_position(rank);
+                return count;
+            }
+
+            const int l = ef->l;
+            auto curr = pos_upper / 64;
+            uint64_t window = ef->upper_bits[curr] & (-1ULL >> (63 - pos_upper % 64));
+            size_t r = rank;
+
+            for (size_t i = 0;;) {
+                while (window != 0) {
+                    const uint64_t pos = curr * 64 + 63 - __builtin_clzll(window);
+                    dest[i] = (pos - r) << l | ef->lower_at(r, pos);
+                    if (++i == count) {
+                        rank = r;
+                        pos_upper = pos;
+                        return count;
+                    }
+                    window &= ~(1ULL << pos % 64);
+                    r--;
+                }
+                window = ef->upper_bits[--curr];
+            }
+        }
+
+        /** Decodes, in increasing order, the current element and the ones following it.
+         *
+         *  Ones of the upper bits are enumerated word by word, and the lower bits
+         *  of each word-sized group are decoded in a row. On return, this pointer
+         *  points at the last element decoded.
+         *
+         * @param dest the destination array.
+         * @param n the maximum number of elements to decode.
+         * @return the number of elements decoded, that is, the minimum between
+         *  `n` and the number of elements from index() onwards.
+         */
+        size_t next(uint64_t *const dest, const size_t n) {
+            const size_t count = min(n, ef->num_ones - rank);
+            if (count == 0) return 0;
+            if (ef->micro_width != 0) {
+                for (size_t i = 0; i < count; i++) dest[i] = ef->micro()[0] + ef->micro_at(rank + i);
+                rank += count - 1;
+                pos_upper = ef->micro_position(rank);
+                return count;
+            }
+
+            const int l = ef->l;
+            auto curr = pos_upper / 64;
+            uint64_t window = ef->upper_bits[curr] & -1ULL << pos_upper % 64;
+            size_t r = rank;
+
+            for (size_t i = 0;;) {
+                while (window != 0) {
+                    const uint64_t pos = curr * 64 + __builtin_ctzll(window);
+                    dest[i] = (pos - r) << l | ef->lower_at(r, pos);
+                    if (++i == count) {
+                        rank = r;
+                        pos_upper = pos;
+                        return count;
+                    }
+                    window &= window - 1;
+                    r++;
+                }
+                window = ef->upper_bits[++curr];
+            }
+        }
+
+        bool operator==(const ElementPointer &oth) const { return rank == oth.rank; }
+
+        bool operator!=(const ElementPointer &oth) const { return rank != oth.rank; }
     };
 
     ElementPointer at(size_t rank) const {
         return ElementPointer(rank, 0, this);
     }
 
+    /** Returns a pointer to the smallest element, from which the sequence
+     *  can be walked with ElementPointer::operator++() or ElementPointer::next().
+     *
+     *  The behavior is undefined if this instance is empty.
+     */
+    ElementPointer first() const {
+        if (micro_width != 0) return ElementPointer(0, micro_position(0), this);
+        size_t curr = 0;
+        while (upper_bits[curr] == 0) ++curr;
+        return ElementPointer(0, curr * 64 + __builtin_ctzll(upper_bits[curr]), this);
+    }
+
+    /** Returns a pointer to the largest element, from which the sequence
+     *  can be walked backwards with ElementPointer::operator--().
+     *
+     *  The behavior is undefined if this instance is empty.
+     */
+    ElementPointer last() const {
+        if (micro_width != 0) return ElementPointer(num_ones - 1, micro_position(num_ones - 1), this);
+        auto curr = upper_bits.size() - 1;
+        while (upper_bits[curr] == 0) --curr;
+        return ElementPointer(num_ones - 1, curr * 64 + 63 - __builtin_clzll(upper_bits[curr]), this);
+    }
+
 
     ElementPointer predecessor(const size_t k) const {
         static_assert(AllowRank, "Cannot call predecessor() if AllowRank is false");
+        if (micro_width != 0) {
+            // The number of elements smaller than or equal to k, minus one
+            const size_t rank = k >= num_bits - 1 ? num_ones - 1 : micro_rank(k + 1) - 1;
+            return ElementPointer(rank, rank == SIZE_MAX ? -1 : micro_position(rank), this);
+        }
         const uint64_t k_shiftr_l = k >> l;
 
         uint64_t pos_hi;
@@ -279,68 +1242,366 @@ public:
             pos_lo = selectz_upper.selectZero(k_shiftr_l - 1, &pos_hi) + 1;
         }
 
-        int64_t pos;
         size_t rank;
-        auto count = pos_hi - pos_lo;
+        int64_t pos;
+        predecessor_in_bucket(k, pos_lo, pos_hi, rank, pos);
+        return ElementPointer(rank, pos, this);
+    }
 
-        if (count < 8) {
-            pos = pos_hi;
-            rank = pos_hi - k_shiftr_l;
-            uint64_t rank_times_l = rank * l;
-            const uint64_t k_lower_bits = k & lower_l_bits_mask;
-            do {
-                rank--;
-                rank_times_l -= l;
-                pos--;
-            } while (pos >= pos_lo && get_bits(lower_bits, rank_times_l, l) > k_lower_bits);
-        } else {
-            auto rank_lo = pos_lo - k_shiftr_l;
-            auto rank_hi = pos_hi - k_shiftr_l;
-            const uint64_t k_lower_bits = k & lower_l_bits_mask;
-
-            while (count > 0) {
-                auto step = count / 2;
-                auto mid = rank_lo + step;
-                if (get_bits(lower_bits, mid * l, l) <= k_lower_bits) {
-                    rank_lo = mid + 1;
-                    count -= step + 1;
+    /** A rank or predecessor query split into stages, so that many queries can be interleaved.
+     *
+     *  A query on a large instance usually incurs a cache miss in the selectZero
+     *  inventory, and then one in the lower bits, each depending on the previous one.
+     *  A staged query runs one such step at a time, ending each step by prefetching
+     *  the memory read by the next one; in the meanwhile, a scheduler such as
+     *  util::interleave() can run steps of other queries. This is the C++17 counterpart
+     *  of a coroutine that suspends after each prefetch.
+     *
+     *  Stages compute the same results as rankv2() (and thus rank()) and predecessor().
+     *  Queries on tiny instances are answered at once by the micro index.
+     */
+    class StagedQuery {
+        const EliasFano *ef;
+        uint64_t k, pos_lo, pos_hi;
+        size_t rank_;
+        int64_t pos;
+        int stage;
+        bool pred;
+
+      public:
+        StagedQuery() = default;
+
+        /** Starts a query, prefetching the memory read by the first stage.
+         *
+         * @param ef an instance, which must be a rank-enabled one.
+         * @param k a value.
+         * @param predecessor if true, this is a predecessor query; otherwise, a rank query.
+         */
+        StagedQuery(const EliasFano &ef, const uint64_t k, const bool predecessor = false) : ef(&ef), k(k), stage(0), pred(predecessor) {
+            static_assert(AllowRank, "Cannot use StagedQuery if AllowRank is false");
+            if (!predecessor && (ef.num_ones == 0 || k >= ef.num_bits)) {
+                rank_ = ef.num_ones;
+                stage = 2;
+                return;
+            }
+            if (ef.micro_width != 0) {
+                if (predecessor) {
+                    const ElementPointer p = ef.predecessor(k);
+                    rank_ = p.rank;
+                    pos = p.pos_upper;
                 } else {
-                    count = step;
+                    rank_ = ef.micro_rank(k);
                 }
+                stage = 2;
+                return;
             }
-            --rank_lo;
-            pos = pos_hi - (rank_hi - rank_lo);
-            rank = rank_lo;
+            const uint64_t k_shiftr_l = k >> ef.l;
+            if (k_shiftr_l != 0) ef.selectz_upper.prefetch(k_shiftr_l - 1);
+            ef.selectz_upper.prefetch(k_shiftr_l);
         }
 
-        if (pos > 0 && (upper_bits[pos / 64] & 1ULL << pos % 64) == 0) {
-            // find previous set bit
-            auto curr = pos / 64;
-            uint64_t word = upper_bits[curr] & ((1ULL << pos % 64) - 1);
-            while (word == 0) word = upper_bits[--curr];
-            pos = curr * 64 + 63 - __builtin_clzll(word);
+        /** Runs the next stage of this query.
+         *
+         * @return true if the query is complete.
+         */
+        bool resume() {
+            const uint64_t k_shiftr_l = k >> ef->l;
+            switch (stage) {
+            case 0:
+                // Locate the bucket, and prefetch its first lower bits and upper bits
+                pos_lo = 0;
+                if (k_shiftr_l == 0) {
+                    pos_hi = ef->selectz_upper.selectZero(k_shiftr_l);
+                } else {
+                    pos_lo = ef->selectz_upper.selectZero(k_shiftr_l - 1, &pos_hi) + 1;
+                }
+                __builtin_prefetch(&ef->lower_bits + (pos_lo - k_shiftr_l) * ef->l / 64);
+                if (pred) __builtin_prefetch(&ef->upper_bits + pos_lo / 64);
+                stage = 1;
+                return false;
+            case 1:
+                if (pred) {
+                    ef->predecessor_in_bucket(k, pos_lo, pos_hi, rank_, pos);
+                } else {
+                    const uint64_t rank_lo = pos_lo - k_shiftr_l;
+                    rank_ = rank_lo + ef->template bucket_search<true>(rank_lo, pos_hi - pos_lo, k & ef->lower_l_bits_mask);
+                }
+                stage = 2;
+                return true;
+            default:
+                return true;
+            }
         }
 
-        return ElementPointer(rank, pos, this);
+        /** Returns the result of a complete rank query. */
+        uint64_t rank() const { return rank_; }
+
+        /** Returns the result of a complete predecessor query. */
+        ElementPointer predecessor() const { return ElementPointer(rank_, pos, ef); }
+    };
+
+    /** Computes rank() for a batch of values, interleaving the stages of the queries.
+     *
+     * @param k the values.
+     * @param n the number of values.
+     * @param dest an array of `n` elements that will be filled with the ranks.
+     * @param width the number of queries in flight.
+     * @see StagedQuery
+     */
+    void rank(const uint64_t *const k, const size_t n, uint64_t *const dest, const size_t width = 16) const {
+        if (micro_width != 0) {
+            for (size_t i = 0; i < n; i++) dest[i] = rank(k[i]);
+            return;
+        }
+        util::interleave<StagedQuery>(
+            n, width, [&](const size_t i) { return StagedQuery(*this, k[i]); }, [&](const size_t i, const StagedQuery &q) { dest[i] = q.rank(); });
     }
 
     size_t numOnes() const { return num_ones; }
 
+    /** Decodes all elements in parallel.
+     *
+     *  The sequence is split by rank into a chunk per thread; the first element of each
+     *  chunk is located in the upper bits by a binary search over selectZero() (or by a scan
+     *  of the upper bits, if AllowRank is false), and then each thread decodes its chunk with
+     *  ElementPointer::next() directly into its slice of `dest`, without any coordination.
+     *
+     * @param dest an array of numOnes() elements that will be filled with the elements, in increasing order.
+     * @param threads the number of threads (zero for the number of hardware threads); fewer threads are used for short sequences.
+     */
+    void decodeAll(uint64_t *const dest, const unsigned threads = 0) const {
+        parallel_chunks(threads, [&](unsigned, ElementPointer p, const size_t n) { p.next(dest + p.index(), n); });
+    }
+
+    /** Decodes all elements in parallel, passing them to a sink in blocks.
+     *
+     *  The sequence is split as in decodeAll(); each thread decodes its chunk into a
+     *  private buffer and passes it to `sink` block by block.
+     *
+     * @param sink a function called as `sink(t, rank, block, n)`, where `t` is the index of the calling thread and `block`
+     *  contains the `n` consecutive elements starting at rank `rank`; each thread calls the sink
+     *  with increasing ranks, concurrently with the other threads.
+     * @param threads the number of threads (zero for the number of hardware threads); fewer threads are used for short sequences.
+     */
+    template <class F> void forEachParallel(F &&sink, const unsigned threads = 0) const {
+        parallel_chunks(threads, [&](const unsigned t, ElementPointer p, size_t n) {
+            uint64_t block[1024];
+            for (size_t rank = p.index(), b; n != 0; n -= b, rank += b) {
+                b = p.next(block, min(n, sizeof block / sizeof *block));
+                sink(t, rank, (const uint64_t *)block, b);
+                if (n != b) ++p;
+            }
+        });
+    }
+
     /** Returns an estimate of the size in bits of this structure. */
     uint64_t bitCount() const {
-        auto select_upper = SimpleSelectHalf(&upper_bits, num_ones + (num_bits >> l));
-        return upper_bits.bitCount() - sizeof(upper_bits) * 8 + lower_bits.bitCount() - sizeof(lower_bits) * 8 + select_upper.bitCount() - sizeof(select_upper) * 8 + selectz_upper.bitCount() -
-            sizeof(selectz_upper) * 8 + sizeof(*this) * 8;
+        // Tiny instances have no upper bits to select on
+        uint64_t select_bits = 0;
+        if (micro_width == 0) {
+            auto select_upper = SimpleSelectHalf(&upper_bits, num_ones + (num_bits >> l));
+            select_bits = select_upper.bitCount() - sizeof(select_upper) * 8;
+        }
+        return upper_bits.bitCount() - sizeof(upper_bits) * 8 + lower_bits.bitCount() - sizeof(lower_bits) * 8 + select_bits + selectz_upper.bitCount() -
+            sizeof(selectz_upper) * 8 + sizeof(*this) * 8 +
+            (side ? side->skip_directory.bitCount() + side->skip_samples.bitCount() + side->point_filter.bitCount() - sizeof(side->skip_directory) * 8 * 3 + sizeof(Side) * 8 : 0);
     }
 
+    /** Advises the kernel about the expected access pattern to all components of this structure.
+     *
+     * @param hint the expected access pattern.
+     * @return true if the hint was accepted by the kernel for all components.
+     */
+    bool advise(util::AccessHint hint) const { return advise(hint, hint); }
+
+    /** Advises the kernel about the expected access pattern to the components of this structure.
+     *
+     *  Queries touch the selectZero inventory and the upper bits several times, but the lower bits
+     *  usually just once, after the position has been narrowed down. For random point or range
+     *  probes on mapped memory a good choice is thus util::AccessHint::WILLNEED for the index and
+     *  util::AccessHint::RANDOM for the lower bits, so that they are faulted in on demand without readahead.
+     *
+     * @param index the expected access pattern to the selectZero inventory and to the upper bits.
+     * @param lower the expected access pattern to the lower bits.
+     * @return true if the hints were accepted by the kernel for all components.
+     */
+    bool advise(util::AccessHint index, util::AccessHint lower) const {
+        bool result = selectz_upper.advise(index);
+        result &= upper_bits.advise(index);
+        result &= lower_bits.advise(lower);
+        return result;
+    }
+
+    /** Moves the lower bits to a file, leaving the selectZero inventory and the upper bits in memory.
+     *
+     *  The lower bits make up most of the space of the structure, but each query touches them just
+     *  once, after the inventory and the upper bits have narrowed down the position. This method
+     *  writes the lower bits at the given offset of a file and replaces them with a read-only
+     *  shared mapping of the same region (see util::Vector::map()), so that only the pages
+     *  actually accessed occupy memory, in the page cache. Further hints can be given with advise().
+     *
+     *  If the file cannot be written or mapped, this structure is left unchanged.
+     *
+     * @param fd a file descriptor open for reading and writing.
+     * @param offset the offset in bytes at which the lower bits will be written.
+     * @return true if the lower bits have been moved to the file.
+     */
+    bool tierLowerBits(int fd, off_t offset) {
+        const char *buffer = reinterpret_cast<const char *>(&lower_bits);
+        size_t length = lower_bits.size() * sizeof(uint64_t);
+        for (off_t pos = offset; length > 0;) {
+            const ssize_t written = pwrite(fd, buffer, length, pos);
+            if (written <= 0) return false;
+            buffer += written;
+            pos += written;
+            length -= written;
+        }
+
+        auto mapped = util::Vector<uint64_t, AT>::map(fd, offset, lower_bits.size());
+        if (lower_bits.size() != 0 && !mapped.isMapped()) return false;
+        lower_bits = std::move(mapped);
+        return true;
+    }
+
+    /** Checks the structural consistency of this instance.
+     *
+     *  Instances loaded from untrusted or possibly corrupted sources may
+     *  cause out-of-bounds memory accesses. The basic check, which takes
+     *  time linear in the size of the selectZero inventory (but not of the
+     *  bit vectors), verifies that the number of lower bits, the sizes
+     *  of the upper and lower bits, and the selectZero inventory are
+     *  consistent with the number of elements and the universe. This catches
+     *  truncated instances and inconsistent headers, but only the deep check
+     *  guarantees that no query on a corrupted instance accesses memory outside
+     *  the structure: it also verifies, in a streaming pass, that the upper bits contain
+     *  exactly numOnes() ones and that the inventory entries point at
+     *  the right zeros (see SimpleSelectZeroHalf::validate() and LearnedSelectZero::validate()).
+     *
+     *  The deep check also verifies that skip tables (see skipTable()) match
+     *  the lower bits, and that the point filter (see pointFilter()) accepts all
+     *  elements; the basic check just verifies their sizes.
+     *
+     *  The order of lower bits within buckets is not checked: a violation
+     *  leads to wrong answers, but not to invalid memory accesses.
+     *
+     * @param deep whether to perform the deep check.
+     * @return true if this instance is consistent.
+     */
+    bool validate(bool deep = false) const {
+        if (!valid_sizes()) return false;
+        const uint64_t upper_length = num_ones + (num_bits >> l) + 1;
+
+        if constexpr (AllowRank) {
+            // Tiny instances have an empty inventory, which queries never access
+            if (micro_width != 0 ? !empty_inventory() : !selectz_upper.validate(upper_length, deep)) return false;
+        }
+
+        // Queries check that samples are within the number of samples stored at the end of the directory
+        if (side) {
+            const util::Vector<uint64_t, AT> &skip_directory = side->skip_directory, &point_filter = side->point_filter;
+            // Empty side structures are never stored
+            if (side->skip_threshold == 0 && point_filter.size() == 0) return false;
+            if (side->skip_threshold == 0) {
+                if (skip_directory.size() != 0 || side->skip_samples.size() != 0) return false;
+            } else {
+                const uint64_t slots = skip_directory.size() / 2;
+                if (l == 0 || micro_width != 0 || skip_directory.size() % 2 == 0 || slots == 1 || (slots & (slots - 1)) != 0) return false;
+                const uint64_t num_samples = skip_directory[skip_directory.size() - 1];
+                if (num_samples > num_ones || side->skip_samples.size() != (num_samples * l + 63) / 64) return false;
+            }
+
+            if (point_filter.size() % point_filter_block != 0 || (micro_width != 0 && point_filter.size() != 0)) return false;
+        }
+
+        if (!deep) return true;
+        if (micro_width == 0 && nu(&upper_bits, upper_bits.size()) != num_ones) return false;
+
+        if (side && side->skip_threshold != 0) {
+            Side tables(util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE);
+            tables.skip_threshold = side->skip_threshold;
+            build_skip_table(tables);
+            const util::Vector<uint64_t, AT> &directory = tables.skip_directory, &samples = tables.skip_samples;
+            if (directory.size() != side->skip_directory.size() || !std::equal(&directory, &directory + directory.size(), &side->skip_directory)) return false;
+            if (!std::equal(&samples, &samples + samples.size(), &side->skip_samples)) return false;
+        }
+
+        if (has_point_filter()) {
+            // The filter must not have false negatives
+            bool ok = true;
+            for_each_element([&](const uint64_t x) { ok &= point_filter_contains(x); });
+            if (!ok) return false;
+        }
+
+        if (micro_width != 0) {
+            // Elements must start from the smallest one, be nondecreasing and smaller than
+            // num_bits, and padding must be the maximum value
+            const uint64_t base = micro()[0];
+            bool ok = micro_at(0) == 0 && base < num_bits && micro_at(num_ones - 1) < num_bits - base;
+            for (uint64_t i = 1; i < num_ones; i++) ok &= micro_at(i - 1) <= micro_at(i);
+            for (uint64_t i = num_ones; i < (micro_words() - 1) * 64 / micro_width; i++) ok &= micro_at(i) == (1ULL << micro_width) - 1;
+            if (!ok) return false;
+        }
+
+        return true;
+    }
+
+    /** Applies a function to all fields of this structure, in serialization order.
+     *
+     *  The function is called on the scalar fields and on the util::Vector instances of this
+     *  structure and of its selectZero inventory; it makes it possible to write generic
+     *  serialization code, such as EliasFanoContainer. After the fields of a new instance have
+     *  been filled, the selectZero inventory must be rebound with
+     *  `selectz_upper.rebind(&upper_bits)`.
+     *
+     *  Opt-in structures are preceded by a flag telling whether they are present: if the function
+     *  sets the flag, they are allocated and their fields are visited too.
+     *
+     * @param f a function accepting a reference to an integer or to a util::Vector.
+     */
+    template <class F> void visit(F &&f) {
+        f(num_bits);
+        f(l);
+        f(num_ones);
+        f(lower_l_bits_mask);
+        f(eytzinger_threshold);
+        f(micro_width);
+        selectz_upper.visit(f);
+        f(upper_bits);
+        f(lower_bits);
+        // The side structures are preceded by a flag telling whether they are present
+        uint64_t has_side = side != nullptr;
+        f(has_side);
+        if (has_side == 0) side.reset();
+        else {
+            if (!side) side = std::make_unique<Side>(lower_bits.allocType());
+            f(side->skip_threshold);
+            f(side->skip_directory);
+            f(side->skip_samples);
+            f(side->point_filter);
+        }
+    }
+
+    /** Const version of visit(F &&). */
+    template <class F> void visit(F &&f) const { const_cast<EliasFano *>(this)->visit(f); }
+
     friend std::ostream& operator<<(std::ostream& out, const EliasFano& ef) {
         out.write(reinterpret_cast<const char*>(&ef.num_bits), sizeof(ef.num_bits));
         out.write(reinterpret_cast<const char*>(&ef.l), sizeof(ef.l));
         out.write(reinterpret_cast<const char*>(&ef.num_ones), sizeof(ef.num_ones));
         out.write(reinterpret_cast<const char*>(&ef.lower_l_bits_mask), sizeof(ef.lower_l_bits_mask));
+        out.write(reinterpret_cast<const char*>(&ef.eytzinger_threshold), sizeof(ef.eytzinger_threshold));
+        out.write(reinterpret_cast<const char*>(&ef.micro_width), sizeof(ef.micro_width));
         out << ef.selectz_upper;
         out << ef.upper_bits;
         out << ef.lower_bits;
+        const uint64_t has_side = ef.side != nullptr;
+        out.write(reinterpret_cast<const char*>(&has_side), sizeof(has_side));
+        if (has_side) {
+            out.write(reinterpret_cast<const char*>(&ef.side->skip_threshold), sizeof(ef.side->skip_threshold));
+            out << ef.side->skip_directory;
+            out << ef.side->skip_samples;
+            out << ef.side->point_filter;
+        }
         return out;
     }
 
@@ -349,9 +1610,22 @@ public:
         in.read(reinterpret_cast<char*>(&ef.l), sizeof(ef.l));
         in.read(reinterpret_cast<char*>(&ef.num_ones), sizeof(ef.num_ones));
         in.read(reinterpret_cast<char*>(&ef.lower_l_bits_mask), sizeof(ef.lower_l_bits_mask));
+        in.read(reinterpret_cast<char*>(&ef.eytzinger_threshold), sizeof(ef.eytzinger_threshold));
+        in.read(reinterpret_cast<char*>(&ef.micro_width), sizeof(ef.micro_width));
         in >> ef.selectz_upper;
         in >> ef.upper_bits;
+        ef.selectz_upper.rebind(&ef.upper_bits);
         in >> ef.lower_bits;
+        uint64_t has_side;
+        in.read(reinterpret_cast<char*>(&has_side), sizeof(has_side));
+        ef.side.reset();
+        if (has_side) {
+            ef.side = std::make_unique<Side>(ef.lower_bits.allocType());
+            in.read(reinterpret_cast<char*>(&ef.side->skip_threshold), sizeof(ef.side->skip_threshold));
+            in >> ef.side->skip_directory;
+            in >> ef.side->skip_samples;
+            in >> ef.side->point_filter;
+        }
         return in;
     }
 };
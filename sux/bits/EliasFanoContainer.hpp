@@ -0,0 +1,313 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2007-2020 Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "EliasFano.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+namespace sux::bits {
+
+using namespace std;
+using namespace sux;
+
+/** A read-only file containing many EliasFano instances, indexed by a sorted directory.
+ *
+ * A container is opened with a single `mmap()`, and each instance can be
+ * obtained as a zero-copy view (see util::Vector::view()) by its index in the
+ * directory in constant time, or by its identifier in logarithmic time. Containers
+ * are written by EliasFanoContainerWriter.
+ *
+ * All fields of the file are 64-bit words in native byte order:
+ * - the magic number MAGIC;
+ * - the instances, each given by the fields enumerated by EliasFano::visit(): integers
+ *   take one word, and vectors take a word containing their length followed by their
+ *   content, padded to a multiple of a word;
+ * - the directory, a sequence of Entry structures sorted by identifier;
+ * - the number of entries of the directory, the offset of the directory and the magic number MAGIC.
+ *
+ * Views remain valid as long as the container they were obtained from is open.
+ * Since the file may be corrupted, views are always checked with the basic
+ * EliasFano::validate(), which rejects truncated and inconsistent instances; the deep
+ * check, which is necessary to rule out out-of-bounds accesses on corrupted files,
+ * can be requested lazily, and it is performed at most once per instance.
+ */
+
+class EliasFanoContainer {
+  public:
+	static constexpr uint64_t MAGIC = 0x3943464544455855ULL; // "UXEDEFC9"
+
+	/** A directory entry. */
+	struct Entry {
+		/** The identifier of the instance. */
+		uint64_t id;
+		/** The offset in bytes of the instance from the start of the file. */
+		uint64_t offset;
+		/** The length in bytes of the instance. */
+		uint64_t length;
+		/** The number of elements of the instance. */
+		uint64_t num_ones;
+		/** The upper bound (excluded) on the elements of the instance. */
+		uint64_t num_bits;
+	};
+
+  private:
+	void *mapping = nullptr;
+	size_t mapping_length = 0;
+	const Entry *directory = nullptr;
+	uint64_t num_entries = 0;
+	// Whether the instance of given index passed the deep check
+	std::unique_ptr<std::atomic<bool>[]> checked;
+
+  public:
+	EliasFanoContainer() = default;
+
+	~EliasFanoContainer() { close(); }
+
+	// Delete copy operators
+	EliasFanoContainer(const EliasFanoContainer &) = delete;
+	EliasFanoContainer &operator=(const EliasFanoContainer &) = delete;
+
+	// Define move operators
+	EliasFanoContainer(EliasFanoContainer &&oth) { swap(*this, oth); }
+
+	EliasFanoContainer &operator=(EliasFanoContainer &&oth) {
+		swap(*this, oth);
+		return *this;
+	}
+
+	friend void swap(EliasFanoContainer &first, EliasFanoContainer &second) noexcept {
+		std::swap(first.mapping, second.mapping);
+		std::swap(first.mapping_length, second.mapping_length);
+		std::swap(first.directory, second.directory);
+		std::swap(first.num_entries, second.num_entries);
+		std::swap(first.checked, second.checked);
+	}
+
+	/** Opens a container, closing the current one, if any.
+	 *
+	 * @param path the path of the container file.
+	 * @return true if the file could be mapped and its header, trailer and directory are consistent.
+	 */
+	bool open(const char *path) {
+		close();
+		const int fd = ::open(path, O_RDONLY);
+		if (fd < 0) return false;
+
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size < 4 * (off_t)sizeof(uint64_t) || st.st_size % sizeof(uint64_t) != 0) {
+			::close(fd);
+			return false;
+		}
+
+		void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mem == MAP_FAILED) return false;
+		mapping = mem;
+		mapping_length = st.st_size;
+
+		const uint64_t *const words = static_cast<const uint64_t *>(mapping);
+		const uint64_t num_words = mapping_length / sizeof(uint64_t);
+		const uint64_t count = words[num_words - 3], offset = words[num_words - 2];
+		const uint64_t directory_end = mapping_length - 3 * sizeof(uint64_t);
+
+		if (words[0] != MAGIC || words[num_words - 1] != MAGIC || offset % sizeof(uint64_t) != 0 || offset < sizeof(uint64_t) || offset > directory_end ||
+			(directory_end - offset) / sizeof(Entry) != count || (directory_end - offset) % sizeof(Entry) != 0) {
+			close();
+			return false;
+		}
+
+		directory = reinterpret_cast<const Entry *>(static_cast<const char *>(mapping) + offset);
+		num_entries = count;
+		checked = std::make_unique<std::atomic<bool>[]>(count);
+		for (uint64_t i = 0; i < count; i++) checked[i].store(false, std::memory_order_relaxed);
+		return true;
+	}
+
+	/** Closes this container; views obtained from it become invalid. */
+	void close() {
+		if (mapping != nullptr) munmap(mapping, mapping_length);
+		mapping = nullptr;
+		mapping_length = 0;
+		directory = nullptr;
+		num_entries = 0;
+		checked.reset();
+	}
+
+	/** Returns the number of instances in this container. */
+	size_t size() const { return num_entries; }
+
+	/** Returns the directory entry of given index.
+	 *
+	 * @param index an index smaller than size().
+	 */
+	const Entry &entry(size_t index) const { return directory[index]; }
+
+	/** Returns the index of the instance with given identifier, or size() if there is no such instance.
+	 *
+	 * @param id an identifier.
+	 */
+	size_t find(uint64_t id) const {
+		const Entry *const end = directory + num_entries;
+		const Entry *e = std::lower_bound(directory, end, id, [](const Entry &entry, uint64_t id) { return entry.id < id; });
+		return e != end && e->id == id ? e - directory : num_entries;
+	}
+
+	/** Sets an EliasFano instance to a zero-copy view of the instance of given index.
+	 *
+	 * The vectors of the view borrow the memory of this container; the allocation
+	 * type of the instance is irrelevant.
+	 *
+	 * @param index an index smaller than size().
+	 * @param ef the instance that will become a view.
+	 * @param deep whether to perform (once) the deep check of EliasFano::validate().
+	 * @return false if the content of the instance exceeds its directory entry or it is inconsistent;
+	 *  in this case `ef` is not modified.
+	 */
+	template <util::AllocType AT, bool AllowRank, template <util::AllocType> class SZ> bool view(size_t index, EliasFano<AT, AllowRank, SZ> &ef, bool deep = false) const {
+		const Entry &e = directory[index];
+		if (e.offset % sizeof(uint64_t) != 0 || e.offset > mapping_length || e.length > mapping_length - e.offset) return false;
+
+		const uint64_t *p = reinterpret_cast<const uint64_t *>(static_cast<const char *>(mapping) + e.offset);
+		uint64_t remaining = e.length / sizeof(uint64_t);
+		bool ok = true;
+
+		EliasFano<AT, AllowRank, SZ> result;
+		result.visit([&](auto &field) {
+			using F = std::remove_reference_t<decltype(field)>;
+			if (!ok || remaining == 0) {
+				ok = false;
+				return;
+			}
+			remaining--;
+			if constexpr (std::is_integral_v<F>) {
+				field = static_cast<F>(*p++);
+			} else {
+				using T = std::remove_reference_t<decltype(*&field)>;
+				const uint64_t size = *p++;
+				const uint64_t words = size > remaining * sizeof(uint64_t) / sizeof(T) ? UINT64_MAX : (size * sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+				if (words > remaining) {
+					ok = false;
+					return;
+				}
+				field = F::view(reinterpret_cast<const T *>(p), size);
+				p += words;
+				remaining -= words;
+			}
+		});
+
+		if (!ok) return false;
+		result.selectz_upper.rebind(&result.upper_bits);
+		if (result.num_ones != e.num_ones || result.num_bits != e.num_bits) return false;
+		deep &= !checked[index].load(std::memory_order_relaxed);
+		if (!result.validate(deep)) return false;
+		if (deep) checked[index].store(true, std::memory_order_relaxed);
+		ef = std::move(result);
+		return true;
+	}
+};
+
+/** A writer for EliasFanoContainer files.
+ *
+ * Instances are appended to an output stream as soon as they are added,
+ * so they can be built and discarded one at a time; the directory is kept in
+ * memory and written, sorted, by finish().
+ */
+
+class EliasFanoContainerWriter {
+	std::ostream &out;
+	std::vector<EliasFanoContainer::Entry> directory;
+	uint64_t pos = 0;
+
+	void write(const void *data, size_t length) {
+		out.write(static_cast<const char *>(data), length);
+		pos += length;
+	}
+
+	void write(uint64_t word) { write(&word, sizeof(word)); }
+
+  public:
+	/** Creates a new writer.
+	 *
+	 * @param out the stream the container will be written to.
+	 */
+	EliasFanoContainerWriter(std::ostream &out) : out(out) { write(EliasFanoContainer::MAGIC); }
+
+	/** Appends an instance to the container.
+	 *
+	 * @param id the identifier of the instance, which must be different from the
+	 *  identifiers of the instances already added.
+	 * @param ef the instance.
+	 */
+	template <util::AllocType AT, bool AllowRank, template <util::AllocType> class SZ> void add(uint64_t id, const EliasFano<AT, AllowRank, SZ> &ef) {
+		const uint64_t start = pos;
+		ef.visit([&](auto &field) {
+			using F = std::remove_reference_t<decltype(field)>;
+			if constexpr (std::is_integral_v<std::remove_const_t<F>>) {
+				write(static_cast<uint64_t>(field));
+			} else {
+				using T = std::remove_const_t<std::remove_reference_t<decltype(*&field)>>;
+				const uint64_t length = field.size() * sizeof(T);
+				write(field.size());
+				write(&field, length);
+				if (length % sizeof(uint64_t) != 0) {
+					const uint64_t zero = 0;
+					write(&zero, sizeof(uint64_t) - length % sizeof(uint64_t));
+				}
+			}
+		});
+		directory.push_back({id, start, pos - start, ef.num_ones, ef.num_bits});
+	}
+
+	/** Writes the directory and the trailer, completing the container.
+	 *
+	 * No instance can be added after calling this method.
+	 */
+	void finish() {
+		std::sort(directory.begin(), directory.end(), [](const auto &a, const auto &b) { return a.id < b.id; });
+		assert(std::adjacent_find(directory.begin(), directory.end(), [](const auto &a, const auto &b) { return a.id == b.id; }) == directory.end() &&
+			   "Duplicate identifiers");
+		const uint64_t offset = pos;
+		write(directory.data(), directory.size() * sizeof(EliasFanoContainer::Entry));
+		write(directory.size());
+		write(offset);
+		write(EliasFanoContainer::MAGIC);
+		out.flush();
+	}
+};
+
+} // namespace sux::bits
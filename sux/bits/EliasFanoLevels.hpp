@@ -0,0 +1,169 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2007-2020 Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "EliasFano.hpp"
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace sux::bits {
+
+using namespace std;
+using namespace sux;
+
+/** A multi-resolution representation of a set for range emptiness queries.
+ *
+ * An instance contains several EliasFano levels: level _i_ represents the set of
+ * prefixes _k_ >> _i_ · `log2_step` of the elements _k_ of the set, so level 0 is the set
+ * itself and each level is coarser, and smaller, than the previous one. All levels are
+ * built in a single pass over the elements.
+ *
+ * A range query is answered on the coarsest level whose cells (the ranges of values
+ * sharing a prefix) are at most a quarter of the length of the range, by a
+ * predecessor() probe for the last cell of the range: if no cell of the range is
+ * nonempty, the range is empty, and if a nonempty cell contained in the range is found
+ * (possibly by a second probe, if the last cell is only partially covered by the range),
+ * the range is not empty. Otherwise, only the two partially covered cells at the ends of
+ * the range might contain elements, and the answer is computed by a probe on level 0. Answers are thus always exact, and
+ * long nonempty ranges are answered by small levels that are more likely to be in cache.
+ *
+ * @tparam AT a type of memory allocation out of sux::util::AllocType.
+ */
+
+template <util::AllocType AT = util::AllocType::MALLOC> class EliasFanoLevels {
+	int log2_step = 0;
+	std::vector<EliasFano<AT>> levels;
+
+	// Returns the largest element of the level not larger than k, or UINT64_MAX if there is no such element
+	static uint64_t predecessor(const EliasFano<AT> &level, const uint64_t k) {
+		if (level.num_ones == 0) return UINT64_MAX;
+		const auto p = level.predecessor(min(k, level.num_bits - 1));
+		return p.index() == SIZE_MAX ? UINT64_MAX : *p;
+	}
+
+  public:
+	EliasFanoLevels() = default;
+
+	/** Creates a new instance using an explicit, sorted list of elements.
+	 *
+	 * The list is read only once, at construction time; duplicates are allowed.
+	 *
+	 * @param begin an iterator to the beginning of the list.
+	 * @param end an iterator to the end of the list.
+	 * @param log2_step the base-2 logarithm of the ratio between the cell sizes of consecutive levels.
+	 * @param num_levels the number of levels, including level 0.
+	 * @param alloc_type the type of allocation, which must be AT unless AT is util::DYNAMIC.
+	 */
+	template <class t_itr>
+	EliasFanoLevels(const t_itr begin, const t_itr end, const int log2_step = 4, const int num_levels = 4,
+					util::AllocType alloc_type = util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: log2_step(log2_step) {
+		assert(log2_step > 0 && num_levels > 0 && (num_levels - 1) * log2_step < 64);
+		std::vector<std::vector<uint64_t>> prefixes(num_levels);
+		for (auto it = begin; it != end; ++it) {
+			for (int i = 0; i < num_levels; i++) {
+				const uint64_t prefix = *it >> i * log2_step;
+				if (prefixes[i].empty() || prefixes[i].back() != prefix) prefixes[i].push_back(prefix);
+			}
+		}
+
+		for (auto &p : prefixes) {
+			levels.emplace_back(p.begin(), p.end(), false, alloc_type);
+			std::vector<uint64_t>().swap(p);
+		}
+	}
+
+	/** Returns whether a closed range contains no element.
+	 *
+	 * @param lo the lower end of the range (included).
+	 * @param hi the upper end of the range (included).
+	 * @return true if no element is in [`lo`..`hi`].
+	 */
+	bool emptyRange(const uint64_t lo, const uint64_t hi) const {
+		if (lo > hi) return true;
+
+		// The coarsest level on which the range contains at least four cells
+		const int log2_length = lambda_safe(hi - lo) - 2;
+		const int i = log2_length <= 0 ? 0 : min(int(levels.size()) - 1, log2_length / log2_step);
+
+		if (i != 0) {
+			const int s = i * log2_step;
+			const uint64_t a = lo >> s, b = hi >> s, mask = (1ULL << s) - 1;
+			// The cells fully contained in the range, which are at least two
+			const uint64_t first_full = a + ((lo & mask) != 0), last_full = b - ((~hi & mask) != 0);
+			uint64_t p = predecessor(levels[i], b);
+			if (p == UINT64_MAX || p < a) return true;
+			// If the last cell is partially covered and nonempty, look before it (usually in the same bucket)
+			if (p > last_full) p = predecessor(levels[i], last_full);
+			if (p != UINT64_MAX && p >= first_full) return false;
+			// Otherwise, only the partially covered cells might be nonempty
+		}
+
+		const uint64_t p = predecessor(levels[0], hi);
+		return p == UINT64_MAX || p < lo;
+	}
+
+	/** Returns the number of levels. */
+	size_t numLevels() const { return levels.size(); }
+
+	/** Returns a level.
+	 *
+	 * @param i the index of a level; level `i` contains the elements shifted right by `i` times the logarithm of the step.
+	 */
+	const EliasFano<AT> &level(size_t i) const { return levels[i]; }
+
+	/** Returns an estimate of the size in bits of this structure. */
+	uint64_t bitCount() const {
+		uint64_t result = sizeof(*this) * 8;
+		for (const auto &level : levels) result += level.bitCount();
+		return result;
+	}
+
+	friend std::ostream &operator<<(std::ostream &out, const EliasFanoLevels &ef) {
+		const uint64_t log2_step = ef.log2_step, num_levels = ef.levels.size();
+		out.write(reinterpret_cast<const char *>(&log2_step), sizeof(log2_step));
+		out.write(reinterpret_cast<const char *>(&num_levels), sizeof(num_levels));
+		for (const auto &level : ef.levels) out << level;
+		return out;
+	}
+
+	friend std::istream &operator>>(std::istream &in, EliasFanoLevels &ef) {
+		uint64_t log2_step, num_levels;
+		in.read(reinterpret_cast<char *>(&log2_step), sizeof(log2_step));
+		in.read(reinterpret_cast<char *>(&num_levels), sizeof(num_levels));
+		ef.log2_step = log2_step;
+		ef.levels.clear();
+		ef.levels.resize(num_levels);
+		for (auto &level : ef.levels) in >> level;
+		return in;
+	}
+};
+
+} // namespace sux::bits
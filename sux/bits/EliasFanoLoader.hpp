@@ -0,0 +1,265 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2007-2020 Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "EliasFanoContainer.hpp"
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+namespace sux::bits {
+
+using namespace std;
+using namespace sux;
+
+/** A bulk loader for EliasFanoContainer files.
+ *
+ * Deserializing many instances with `>>` issues a small read for each field of each
+ * instance, one instance at a time. This loader reads the instances of a container in
+ * parallel with a pool of threads issuing positioned reads (`pread()`): each instance
+ * is read starting with a single large read of its header, and large arrays are read
+ * directly into their final util::Vector allocation, without intermediate copies.
+ *
+ * Optionally, selectZero inventories are not read but rebuilt from the upper bits:
+ * in this case the rebuilding of an instance overlaps with the I/O of the other threads.
+ *
+ * Loaded instances are checked with the basic EliasFano::validate(), which rejects
+ * truncated and inconsistent instances; files that might be corrupted should also be
+ * checked with the deep check before being queried.
+ */
+
+class EliasFanoLoader {
+	static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+	// Buffered positioned reader over a region of a file.
+	class Reader {
+		const int fd;
+		uint64_t pos, end;
+		std::unique_ptr<char[]> buffer = std::make_unique<char[]>(BUFFER_SIZE);
+		size_t buffer_pos = 0, buffer_length = 0;
+
+		static bool pread_fully(int fd, char *dest, size_t length, uint64_t offset) {
+			while (length > 0) {
+				const ssize_t result = ::pread(fd, dest, length, offset);
+				if (result < 0 && errno == EINTR) continue;
+				if (result <= 0) return false;
+				dest += result;
+				offset += result;
+				length -= result;
+			}
+			return true;
+		}
+
+	  public:
+		Reader(int fd) : fd(fd) {}
+
+		void seek(uint64_t offset, uint64_t length) {
+			pos = offset;
+			end = offset + length;
+			buffer_pos = buffer_length = 0;
+		}
+
+		bool read(void *dest, size_t length) {
+			if (length > end - pos) return false;
+			if (length == 0) return true;
+			char *d = static_cast<char *>(dest);
+			const size_t buffered = min(length, buffer_length - buffer_pos);
+			memcpy(d, buffer.get() + buffer_pos, buffered);
+			buffer_pos += buffered;
+			pos += buffered;
+			d += buffered;
+			length -= buffered;
+			if (length == 0) return true;
+
+			if (length >= BUFFER_SIZE) {
+				// Large arrays are read directly into their final destination
+				if (!pread_fully(fd, d, length, pos)) return false;
+				pos += length;
+				return true;
+			}
+
+			buffer_length = min(uint64_t(BUFFER_SIZE), end - pos);
+			buffer_pos = 0;
+			if (!pread_fully(fd, buffer.get(), buffer_length, pos)) return false;
+			memcpy(d, buffer.get(), length);
+			buffer_pos = length;
+			pos += length;
+			return true;
+		}
+
+		uint64_t remaining() const { return end - pos; }
+
+		bool skip(uint64_t length) {
+			if (length > end - pos) return false;
+			const size_t buffered = min(length, uint64_t(buffer_length - buffer_pos));
+			buffer_pos += buffered;
+			pos += length;
+			if (buffered < length) buffer_pos = buffer_length = 0;
+			return true;
+		}
+	};
+
+	unsigned threads;
+	bool rebuild_inventory;
+
+	// Returns whether an object lies within another object
+	template <class T, class O> static bool is_member(const T *field, const O &object) {
+		const char *const p = reinterpret_cast<const char *>(field), *const start = reinterpret_cast<const char *>(std::addressof(object));
+		return p >= start && p < start + sizeof(O);
+	}
+
+	template <util::AllocType AT, bool AllowRank, template <util::AllocType> class SZ> bool load(Reader &reader, EliasFano<AT, AllowRank, SZ> &ef, util::AllocType alloc_type) const {
+		bool ok = true;
+		ef.visit([&](auto &field) {
+			using F = std::remove_reference_t<decltype(field)>;
+			if (!ok) return;
+			uint64_t word;
+			if (!reader.read(&word, sizeof(word))) {
+				ok = false;
+				return;
+			}
+			if constexpr (std::is_integral_v<F>) {
+				field = static_cast<F>(word);
+			} else {
+				using T = std::remove_reference_t<decltype(*&field)>;
+				// The length must be checked against the record before allocating
+				if (word > reader.remaining() / sizeof(T)) {
+					ok = false;
+					return;
+				}
+				const uint64_t length = word * sizeof(T), padded = (length + sizeof(uint64_t) - 1) & ~uint64_t(sizeof(uint64_t) - 1);
+				if (padded > reader.remaining()) {
+					ok = false;
+					return;
+				}
+				// Vectors of the selectZero structure are recognized by their address, whatever their type
+				if (rebuild_inventory && is_member(std::addressof(field), ef.selectz_upper)) {
+					ok = reader.skip(padded);
+					return;
+				}
+				F vector(alloc_type);
+				vector.sizeUninitialized(word);
+				ok = reader.read(&vector, length) && reader.skip(padded - length);
+				field = std::move(vector);
+			}
+		});
+
+		if (!ok) return false;
+		if constexpr (AllowRank) {
+			if (rebuild_inventory) {
+				// The inventory can be built only on upper bits of the right size
+				if (!ef.valid_sizes()) return false;
+				ef.rebuildInventory();
+			}
+			else
+				ef.selectz_upper.rebind(&ef.upper_bits);
+		}
+		return ef.validate();
+	}
+
+  public:
+	/** Creates a new loader.
+	 *
+	 * @param threads the number of reading threads (zero for the number of hardware threads).
+	 * @param rebuild_inventory if true, selectZero inventories are not read, but rather rebuilt after loading.
+	 */
+	EliasFanoLoader(unsigned threads = 0, bool rebuild_inventory = false)
+		: threads(threads == 0 ? max(1U, std::thread::hardware_concurrency()) : threads), rebuild_inventory(rebuild_inventory) {}
+
+	/** Loads all instances of a container.
+	 *
+	 * @param path the path of a file written by EliasFanoContainerWriter.
+	 * @param directory a vector that will be filled with the directory of the container.
+	 * @param dest a vector that will be filled with the instances, in directory order.
+	 * @param alloc_type the type of allocation of the instances, which must be AT unless AT is util::DYNAMIC.
+	 * @return true if the container could be read and all instances are consistent with the directory.
+	 */
+	template <util::AllocType AT, bool AllowRank, template <util::AllocType> class SZ>
+	bool load(const char *path, std::vector<EliasFanoContainer::Entry> &directory, std::vector<EliasFano<AT, AllowRank, SZ>> &dest,
+			  util::AllocType alloc_type = util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE) const {
+		const int fd = ::open(path, O_RDONLY);
+		if (fd < 0) return false;
+
+		Reader reader(fd);
+		const off_t file_length = lseek(fd, 0, SEEK_END);
+		uint64_t trailer[3], magic;
+		reader.seek(0, file_length < 0 ? 0 : file_length);
+		bool ok = file_length >= 4 * (off_t)sizeof(uint64_t) && reader.read(&magic, sizeof(magic)) && magic == EliasFanoContainer::MAGIC;
+		if (ok) {
+			reader.seek(file_length - sizeof(trailer), sizeof(trailer));
+			// As in EliasFanoContainer::open(), the count is checked by division, which cannot overflow
+			const uint64_t directory_end = file_length - sizeof(trailer);
+			ok = reader.read(trailer, sizeof(trailer)) && trailer[2] == EliasFanoContainer::MAGIC && trailer[1] % sizeof(uint64_t) == 0 && trailer[1] >= sizeof(uint64_t) &&
+				 trailer[1] <= directory_end && (directory_end - trailer[1]) / sizeof(EliasFanoContainer::Entry) == trailer[0] &&
+				 (directory_end - trailer[1]) % sizeof(EliasFanoContainer::Entry) == 0;
+		}
+		if (ok) {
+			directory.resize(trailer[0]);
+			reader.seek(trailer[1], trailer[0] * sizeof(EliasFanoContainer::Entry));
+			ok = reader.read(directory.data(), trailer[0] * sizeof(EliasFanoContainer::Entry));
+		}
+		if (!ok) {
+			::close(fd);
+			return false;
+		}
+
+		dest.clear();
+		dest.resize(directory.size());
+		std::atomic<size_t> next(0);
+		std::atomic<bool> failed(false);
+		std::vector<std::thread> pool;
+
+		for (unsigned t = 0; t < min(size_t(threads), directory.size()); t++) {
+			pool.emplace_back([&] {
+				Reader reader(fd);
+				for (size_t i; !failed && (i = next++) < directory.size();) {
+					const EliasFanoContainer::Entry &e = directory[i];
+					if (e.offset > uint64_t(file_length) || e.length > file_length - e.offset) {
+						failed = true;
+						break;
+					}
+					reader.seek(e.offset, e.length);
+					if (!load(reader, dest[i], alloc_type)) failed = true;
+				}
+			});
+		}
+
+		for (auto &thread : pool) thread.join();
+		::close(fd);
+		return !failed;
+	}
+};
+
+} // namespace sux::bits
@@ -0,0 +1,224 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2007-2020 Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "EliasFano.hpp"
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace sux::bits {
+
+using namespace std;
+using namespace sux;
+
+/** The difference between two versions of a sequence represented by EliasFano.
+ *
+ * A patch contains the elements inserted into and deleted from a base
+ * sequence, each represented in turn by an EliasFano instance without rank
+ * support, so its size is proportional to the number of changes rather than
+ * to the size of the sequences. Both the computation of a patch and its
+ * application scan the sequences in a single merge pass, decoding elements
+ * in blocks (see EliasFano::ElementPointer::next()); the result of apply()
+ * is encoded on the fly by an EliasFano::Builder, so the base sequence is
+ * never decoded into an array.
+ *
+ * The number of elements and the universe of both versions, and a hash of the
+ * elements of the base sequence, are recorded in the patch, and apply() fails
+ * if the patch does not match the base. Sequences may contain duplicates: a
+ * patch records the difference of the two versions as multisets.
+ *
+ * @tparam AT a type of memory allocation out of sux::util::AllocType.
+ */
+
+template <util::AllocType AT = util::AllocType::MALLOC> class EliasFanoPatch {
+	static constexpr size_t BLOCK_SIZE = 256;
+
+	uint64_t base_num_ones = 0, base_num_bits = 0, base_hash = 0;
+	uint64_t num_ones = 0, num_bits = 0;
+	EliasFano<AT, false> inserted, deleted;
+
+	// Block-decoding cursor over the elements of an EliasFano instance.
+	template <class E> class Cursor {
+		const E &ef;
+		typename E::ElementPointer ptr;
+		uint64_t block[BLOCK_SIZE];
+		size_t pos = 0, length = 0;
+
+	  public:
+		Cursor(const E &ef) : ef(ef), ptr(ef.num_ones == 0 ? typename E::ElementPointer(0, 0, &ef) : ef.first()) {
+			length = ptr.next(block, BLOCK_SIZE);
+		}
+
+		bool empty() const { return pos == length; }
+
+		uint64_t peek() const { return block[pos]; }
+
+		void advance() {
+			if (++pos < length || ptr.index() + 1 == ef.num_ones) return;
+			++ptr;
+			pos = 0;
+			length = ptr.next(block, BLOCK_SIZE);
+		}
+	};
+
+  public:
+	EliasFanoPatch() : inserted(empty_sequence()), deleted(empty_sequence()) {}
+
+	/** Creates a patch transforming a sequence into another.
+	 *
+	 * @param from the base sequence.
+	 * @param to the new sequence.
+	 */
+	template <util::AllocType AT2, bool AllowRank, template <util::AllocType> class SZ>
+	EliasFanoPatch(const EliasFano<AT2, AllowRank, SZ> &from, const EliasFano<AT2, AllowRank, SZ> &to)
+		: base_num_ones(from.num_ones), base_num_bits(from.num_bits), num_ones(to.num_ones), num_bits(to.num_bits) {
+		std::vector<uint64_t> ins, del;
+		Cursor<EliasFano<AT2, AllowRank, SZ>> f(from), t(to);
+
+		while (!f.empty() && !t.empty()) {
+			const uint64_t x = f.peek(), y = t.peek();
+			if (x == y) {
+				base_hash = hash(base_hash, x);
+				f.advance();
+				t.advance();
+			} else if (x < y) {
+				base_hash = hash(base_hash, x);
+				del.push_back(x);
+				f.advance();
+			} else {
+				ins.push_back(y);
+				t.advance();
+			}
+		}
+		for (; !f.empty(); f.advance()) {
+			base_hash = hash(base_hash, f.peek());
+			del.push_back(f.peek());
+		}
+		for (; !t.empty(); t.advance()) ins.push_back(t.peek());
+
+		inserted = EliasFano<AT, false>(ins.begin(), ins.end());
+		deleted = EliasFano<AT, false>(del.begin(), del.end());
+	}
+
+	/** Returns the number of elements inserted by this patch. */
+	size_t numInserted() const { return inserted.num_ones; }
+
+	/** Returns the number of elements deleted by this patch. */
+	size_t numDeleted() const { return deleted.num_ones; }
+
+	/** Applies this patch to a sequence.
+	 *
+	 * @param base the base sequence this patch was computed from.
+	 * @param dest an instance that will be replaced by the new sequence, with the same type of allocation as `base`.
+	 * @return false if this patch does not apply to `base`; in this case `dest` is not modified.
+	 */
+	template <util::AllocType AT2, bool AllowRank, template <util::AllocType> class SZ> bool apply(const EliasFano<AT2, AllowRank, SZ> &base, EliasFano<AT2, AllowRank, SZ> &dest) const {
+		if (base.num_ones != base_num_ones || base.num_bits != base_num_bits) return false;
+		if (base_num_ones + inserted.num_ones - deleted.num_ones != num_ones) return false;
+
+		typename EliasFano<AT2, AllowRank, SZ>::Builder builder(num_ones, num_bits, base.upper_bits.allocType());
+		Cursor<EliasFano<AT2, AllowRank, SZ>> b(base);
+		Cursor<EliasFano<AT, false>> ins(inserted), del(deleted);
+		uint64_t h = 0;
+
+		while (!b.empty()) {
+			const uint64_t x = b.peek();
+			if (!ins.empty() && ins.peek() <= x) {
+				// Inserted elements equal to a base element precede it
+				if (ins.peek() >= num_bits) return false;
+				builder.add(ins.peek());
+				ins.advance();
+				continue;
+			}
+			if (!del.empty() && del.peek() <= x) {
+				// Deleted elements must be in the base sequence
+				if (del.peek() != x) return false;
+				del.advance();
+			} else {
+				if (x >= num_bits) return false;
+				builder.add(x);
+			}
+			h = hash(h, x);
+			b.advance();
+		}
+		if (!del.empty() || h != base_hash) return false;
+		for (; !ins.empty(); ins.advance()) {
+			if (ins.peek() >= num_bits) return false;
+			builder.add(ins.peek());
+		}
+
+		dest = builder.build();
+		return true;
+	}
+
+	/** Returns an estimate of the size in bits of this structure. */
+	uint64_t bitCount() const {
+		return inserted.bitCount() - sizeof(inserted) * 8 + deleted.bitCount() - sizeof(deleted) * 8 + sizeof(*this) * 8;
+	}
+
+	friend std::ostream &operator<<(std::ostream &out, const EliasFanoPatch &patch) {
+		out.write(reinterpret_cast<const char *>(&patch.base_num_ones), sizeof(patch.base_num_ones));
+		out.write(reinterpret_cast<const char *>(&patch.base_num_bits), sizeof(patch.base_num_bits));
+		out.write(reinterpret_cast<const char *>(&patch.base_hash), sizeof(patch.base_hash));
+		out.write(reinterpret_cast<const char *>(&patch.num_ones), sizeof(patch.num_ones));
+		out.write(reinterpret_cast<const char *>(&patch.num_bits), sizeof(patch.num_bits));
+		out << patch.inserted;
+		out << patch.deleted;
+		return out;
+	}
+
+	friend std::istream &operator>>(std::istream &in, EliasFanoPatch &patch) {
+		in.read(reinterpret_cast<char *>(&patch.base_num_ones), sizeof(patch.base_num_ones));
+		in.read(reinterpret_cast<char *>(&patch.base_num_bits), sizeof(patch.base_num_bits));
+		in.read(reinterpret_cast<char *>(&patch.base_hash), sizeof(patch.base_hash));
+		in.read(reinterpret_cast<char *>(&patch.num_ones), sizeof(patch.num_ones));
+		in.read(reinterpret_cast<char *>(&patch.num_bits), sizeof(patch.num_bits));
+		in >> patch.inserted;
+		in >> patch.deleted;
+		return in;
+	}
+
+  private:
+	// Combines a hash of a sequence with its next element, using the MurmurHash3 finalizer
+	static uint64_t hash(const uint64_t h, uint64_t x) {
+		x ^= x >> 33;
+		x *= 0xFF51AFD7ED558CCDULL;
+		x ^= x >> 33;
+		x *= 0xC4CEB9FE1A85EC53ULL;
+		return (h ^ x ^ x >> 33) * 0x9E3779B97F4A7C15ULL;
+	}
+
+	static EliasFano<AT, false> empty_sequence() {
+		uint64_t *none = nullptr;
+		return EliasFano<AT, false>(none, none);
+	}
+};
+
+} // namespace sux::bits
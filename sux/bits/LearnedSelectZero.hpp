@@ -0,0 +1,357 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2007-2020 Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../support/common.hpp"
+#include "../util/Vector.hpp"
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace sux::bits {
+
+using namespace std;
+using namespace sux;
+
+/** A SelectZero implementation based on a piecewise-linear model of the positions of the zeros.
+ *
+ * When the bit vector is the upper-bits array of an EliasFano instance built on
+ * near-uniform elements (e.g., hashes), the position of the zero of rank _j_ is almost
+ * linear in _j_. This class samples the zeros of rank multiple of 64 and fits
+ * their positions with linear segments whose error is at most 127 positions, in the
+ * spirit of the PGM-index; the difference between the actual and the predicted
+ * position of each sample is then stored in 8 bits. Selecting a zero requires finding
+ * its segment, evaluating the model, correcting it with the stored difference and
+ * scanning, as in SimpleSelectZeroHalf, at most 63 zeros with popcounts.
+ *
+ * For near-uniform elements segments contain about a thousand samples, and the
+ * structure takes about 1/8 of a bit per zero, less than half of SimpleSelectZeroHalf.
+ * Segments are located through a table recording, for groups of samples as large
+ * as an average segment, the segment containing the first sample of the group.
+ * For skewed distributions, however, segments become short and SimpleSelectZeroHalf
+ * should be preferred.
+ *
+ * The constructors of this class only store a reference
+ * to a provided bit vector. Should the content of the
+ * bit vector change, the results will be unpredictable.
+ *
+ * This class can be used as selectZero structure of EliasFano in place of SimpleSelectZeroHalf.
+ *
+ * @tparam AT a type of memory allocation out of sux::util::AllocType.
+ */
+
+template <util::AllocType AT = util::AllocType::MALLOC> class LearnedSelectZero {
+  private:
+	static const int log2_zeros_per_sample = 6;
+	static const uint64_t zeros_per_sample = 1 << log2_zeros_per_sample;
+	static const uint64_t zeros_per_sample_mask = zeros_per_sample - 1;
+	// The maximum error of the model, and the width of the stored corrections
+	static const uint64_t epsilon = 127;
+	static const int correction_width = 8;
+	// Slopes are fixed-point numbers with this number of fractional bits
+	static const int slope_shift = 32;
+
+	const uint64_t *bits = nullptr;
+	// Triples (index of the first sample, position of the first sample, slope)
+	util::Vector<uint64_t, AT> segments;
+	// For each sample, its position minus the predicted position plus epsilon, packed in correction_width bits
+	util::Vector<uint64_t, AT> corrections;
+	// For each group of 2^log2_samples_per_group samples, the segment containing its first sample
+	util::Vector<uint64_t, AT> groups;
+
+	uint64_t num_words = 0, num_zeros = 0, num_samples = 0, log2_samples_per_group = 0;
+
+	template <util::AllocType> friend class LearnedSelectZero;
+
+	__inline uint64_t predict(const uint64_t *const segment, const uint64_t sample) const {
+		return segment[1] + uint64_t(((__uint128_t)segment[2] * (sample - segment[0])) >> slope_shift);
+	}
+
+	__inline const uint64_t *find_segment(const uint64_t sample) const {
+		// The last segment whose first sample is not larger than sample
+		const uint64_t *s = &segments + 3 * min(groups[sample >> log2_samples_per_group], segments.size() / 3 - 1);
+		const uint64_t *const end = &segments + segments.size();
+		while (s + 3 != end && s[3] <= sample) s += 3;
+		return s;
+	}
+
+	__inline uint64_t correction(const uint64_t sample) const { return bitread(&corrections + sample * correction_width / 64, sample * correction_width % 64, correction_width); }
+
+	// Returns the range of slopes such that the segment starting at (x0, y0) predicts y at x
+	// (x > x0) with error at most epsilon, intersected with [*lo, *hi]
+	static void narrow(const uint64_t x0, const uint64_t y0, const uint64_t x, const uint64_t y, __uint128_t *lo, __uint128_t *hi) {
+		const __uint128_t dx = x - x0;
+		// The prediction y0 + floor(slope * dx / 2^slope_shift) must lie in [y - epsilon, y + epsilon]
+		if (y >= y0 + epsilon) *lo = max(*lo, ((__uint128_t(y - epsilon - y0) << slope_shift) + dx - 1) / dx);
+		*hi = min(*hi, ((__uint128_t(y + epsilon - y0 + 1) << slope_shift) - 1) / dx);
+	}
+
+  public:
+	LearnedSelectZero() {}
+
+	/** Creates a copy of an instance with a different type of memory allocation.
+	 *
+	 * The model is copied, not rebuilt, and the new instance is bound to a given
+	 * bit vector, which must have the same content as that of the copied instance.
+	 *
+	 * @param oth the instance to copy.
+	 * @param bits a bit vector of 64-bit words with the same content as the one `oth` was built on.
+	 * @param alloc_type the type of allocation of the model, which must be AT unless AT is util::DYNAMIC.
+	 */
+	template <util::AllocType AT2>
+	explicit LearnedSelectZero(const LearnedSelectZero<AT2> &oth, const uint64_t *const bits, util::AllocType alloc_type = util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: bits(bits), segments(oth.segments, alloc_type), corrections(oth.corrections, alloc_type), groups(oth.groups, alloc_type), num_words(oth.num_words),
+		  num_zeros(oth.num_zeros), num_samples(oth.num_samples), log2_samples_per_group(oth.log2_samples_per_group) {}
+
+	/** Creates a new instance using a given bit vector.
+	 *
+	 * @param bits a bit vector of 64-bit words.
+	 * @param num_bits the length (in bits) of the bit vector.
+	 * @param alloc_type the type of allocation of the model, which must be AT unless AT is util::DYNAMIC.
+	 */
+	LearnedSelectZero(const uint64_t *const bits, const uint64_t num_bits, util::AllocType alloc_type = util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: bits(bits), segments(alloc_type), corrections(alloc_type), groups(alloc_type) {
+		num_words = (num_bits + 63) / 64;
+
+		uint64_t c = 0;
+		for (uint64_t i = 0; i < num_words; i++) c += __builtin_popcountll(~bits[i]);
+		num_zeros = c;
+
+		if (num_bits % 64 != 0) c -= 64 - num_bits % 64;
+		assert(c <= num_bits);
+
+		num_samples = (c + zeros_per_sample - 1) / zeros_per_sample;
+		std::vector<uint64_t> pos;
+		pos.reserve(num_samples);
+		for (uint64_t i = 0, d = 0; i < num_words; i++) {
+			uint64_t zeros = ~bits[i];
+			if ((i + 1) * 64 > num_bits) zeros &= (1ULL << num_bits % 64) - 1;
+			const uint64_t count = nu(zeros);
+			for (uint64_t s = (d + zeros_per_sample_mask) & ~zeros_per_sample_mask; s < d + count; s += zeros_per_sample) pos.push_back(i * 64 + select64(zeros, s - d));
+			d += count;
+		}
+		assert(pos.size() == num_samples);
+
+		// Greedy segmentation: a segment is extended as long as some slope fits all its samples
+		for (uint64_t x0 = 0; x0 < num_samples;) {
+			__uint128_t lo = 0, hi = UINT64_MAX, slope = 0;
+			uint64_t x = x0 + 1;
+			for (; x < num_samples; x++) {
+				__uint128_t l = lo, h = hi;
+				narrow(x0, pos[x0], x, pos[x], &l, &h);
+				if (l > h) break;
+				lo = l;
+				hi = h;
+				slope = lo + (hi - lo) / 2;
+			}
+			segments.pushBack(x0);
+			segments.pushBack(pos[x0]);
+			segments.pushBack(uint64_t(slope));
+			x0 = x;
+		}
+		segments.trimToFit();
+
+		// Groups contain on average at most one segment boundary, so find_segment() scans few segments
+		const uint64_t num_segments = segments.size() / 3;
+		if (num_segments != 0)
+			while (num_samples >> (log2_samples_per_group + 1) >= num_segments) log2_samples_per_group++;
+		groups.size(num_samples == 0 ? 0 : ((num_samples - 1) >> log2_samples_per_group) + 1);
+		for (uint64_t g = 0, s = 0; g < groups.size(); g++) {
+			while (s + 1 < num_segments && segments[3 * (s + 1)] <= g << log2_samples_per_group) s++;
+			groups[g] = s;
+		}
+
+		corrections.size((num_samples * correction_width + 63) / 64);
+		for (uint64_t i = 0; i < num_samples; i++) {
+			const uint64_t c = pos[i] - predict(find_segment(i), i) + epsilon;
+			assert(c <= 2 * epsilon);
+			bitwrite(&corrections + i * correction_width / 64, i * correction_width % 64, correction_width, c);
+		}
+	}
+
+	uint64_t selectZero(const uint64_t rank) const {
+		assert(rank < num_zeros);
+
+		const uint64_t sample = rank >> log2_zeros_per_sample;
+		const uint64_t start = predict(find_segment(sample), sample) + correction(sample) - epsilon;
+		int residual = rank & zeros_per_sample_mask;
+		if (residual == 0) return start;
+
+		uint64_t word_index = start / 64;
+		uint64_t word = ~bits[word_index] & -1ULL << start % 64;
+
+		for (;;) {
+			const int bit_count = __builtin_popcountll(word);
+			if (residual < bit_count) break;
+			word = ~bits[++word_index];
+			residual -= bit_count;
+		}
+
+		return word_index * 64 + select64(word, residual);
+	}
+
+	/** Prefetches the parts of the model used by selectZero() for a given rank.
+	 *
+	 * @param rank a rank smaller than the number of zeros.
+	 */
+	void prefetch(const uint64_t rank) const {
+		const uint64_t sample = rank >> log2_zeros_per_sample;
+		__builtin_prefetch(&groups + (sample >> log2_samples_per_group));
+		__builtin_prefetch(&corrections + sample * correction_width / 64);
+	}
+
+	uint64_t selectZero(const uint64_t rank, uint64_t *const next) const {
+		const uint64_t s = selectZero(rank);
+		uint64_t curr = s / 64;
+
+		uint64_t window = ~bits[curr] & -1ULL << s % 64;
+		window &= window - 1;
+
+		while (window == 0) window = ~bits[++curr];
+		*next = curr * 64 + __builtin_ctzll(window);
+
+		return s;
+	}
+
+	/** Returns the number of linear segments of the model. */
+	size_t numSegments() const { return segments.size() / 3; }
+
+	/** Returns an estimate of the size (in bits) of this structure. */
+	size_t bitCount() const {
+		return segments.bitCount() - sizeof(segments) * 8 + corrections.bitCount() - sizeof(corrections) * 8 + groups.bitCount() - sizeof(groups) * 8 + sizeof(*this) * 8;
+	};
+
+	/** Advises the kernel about the expected access pattern to the model.
+	 *
+	 * The bit vector is not affected, as it is not owned by this structure.
+	 *
+	 * @param hint the expected access pattern.
+	 * @return true if the hint was accepted by the kernel.
+	 */
+	bool advise(util::AccessHint hint) const {
+		bool result = segments.advise(hint);
+		result &= corrections.advise(hint);
+		return groups.advise(hint) && result;
+	}
+
+	/** Checks the consistency of this structure.
+	 *
+	 * The basic check, which takes constant time, verifies that the sizes of
+	 * the model are consistent with each other and with the length of the
+	 * bit vector. The deep check also recounts the zeros of the bit vector and
+	 * verifies, in a single streaming pass, that the model locates every sampled zero.
+	 *
+	 * @param num_bits the length (in bits) of the bit vector this structure should index.
+	 * @param deep whether to perform the deep check.
+	 * @return true if this structure is consistent.
+	 */
+	bool validate(const uint64_t num_bits, const bool deep = false) const {
+		if (num_words != (num_bits + 63) / 64 || num_zeros > num_words * 64 || num_zeros < num_words * 64 - num_bits) return false;
+		if (num_words != 0 && bits == nullptr) return false;
+		const uint64_t c = num_zeros - (num_words * 64 - num_bits); // Indexed zeros
+		if (num_samples != (c + zeros_per_sample - 1) / zeros_per_sample) return false;
+		if (corrections.size() != (num_samples * correction_width + 63) / 64) return false;
+		if (segments.size() % 3 != 0 || segments.size() / 3 > num_samples || (num_samples != 0 && (segments.size() == 0 || segments[0] != 0))) return false;
+		if (log2_samples_per_group >= 64 || groups.size() != (num_samples == 0 ? 0 : ((num_samples - 1) >> log2_samples_per_group) + 1)) return false;
+		if (!deep) return true;
+
+		if (num_words * 64 - nu(bits, num_words) != num_zeros) return false;
+
+		for (uint64_t i = 3; i < segments.size(); i += 3)
+			if (segments[i] <= segments[i - 3] || segments[i] >= num_samples) return false;
+		for (uint64_t g = 0; g < groups.size(); g++)
+			if (groups[g] >= segments.size() / 3 || segments[3 * groups[g]] > g << log2_samples_per_group || (groups[g] + 1 < segments.size() / 3 && segments[3 * groups[g] + 3] <= g << log2_samples_per_group)) return false;
+
+		uint64_t d = 0;
+		for (uint64_t i = 0; i < num_words; i++) {
+			uint64_t zeros = ~bits[i];
+			if ((i + 1) * 64 > num_bits) zeros &= (1ULL << num_bits % 64) - 1;
+			const uint64_t count = nu(zeros);
+
+			for (uint64_t s = (d + zeros_per_sample_mask) & ~zeros_per_sample_mask; s < d + count; s += zeros_per_sample) {
+				const uint64_t sample = s >> log2_zeros_per_sample;
+				if (predict(find_segment(sample), sample) + correction(sample) - epsilon != i * 64 + select64(zeros, s - d)) return false;
+			}
+
+			d += count;
+		}
+
+		return d == c;
+	}
+
+	/** Applies a function to the scalar fields and to the model of this structure.
+	 *
+	 * This method makes it possible to write generic serialization code. The bit vector
+	 * is not visited: after reconstructing an instance it must be set with rebind().
+	 *
+	 * @param f a function accepting a reference to a `uint64_t` or to a util::Vector.
+	 */
+	template <class F> void visit(F &&f) {
+		f(num_words);
+		f(num_zeros);
+		f(num_samples);
+		f(log2_samples_per_group);
+		f(segments);
+		f(corrections);
+		f(groups);
+	}
+
+	/** Const version of visit(F &&). */
+	template <class F> void visit(F &&f) const { const_cast<LearnedSelectZero *>(this)->visit(f); }
+
+	/** Sets the bit vector used by this structure, without rebuilding the model.
+	 *
+	 * @param bits a bit vector of 64-bit words with the same content as the one this instance was built on.
+	 */
+	void rebind(const uint64_t *const bits) { this->bits = bits; }
+
+	friend std::ostream &operator<<(std::ostream &out, const LearnedSelectZero<AT> &sz) {
+		out.write(reinterpret_cast<const char *>(&sz.num_words), sizeof(sz.num_words));
+		out.write(reinterpret_cast<const char *>(&sz.num_zeros), sizeof(sz.num_zeros));
+		out.write(reinterpret_cast<const char *>(&sz.num_samples), sizeof(sz.num_samples));
+		out.write(reinterpret_cast<const char *>(&sz.log2_samples_per_group), sizeof(sz.log2_samples_per_group));
+		out << sz.segments;
+		out << sz.corrections;
+		out << sz.groups;
+		return out;
+	}
+
+	friend std::istream &operator>>(std::istream &in, LearnedSelectZero<AT> &sz) {
+		in.read(reinterpret_cast<char *>(&sz.num_words), sizeof(sz.num_words));
+		in.read(reinterpret_cast<char *>(&sz.num_zeros), sizeof(sz.num_zeros));
+		in.read(reinterpret_cast<char *>(&sz.num_samples), sizeof(sz.num_samples));
+		in.read(reinterpret_cast<char *>(&sz.log2_samples_per_group), sizeof(sz.log2_samples_per_group));
+		in >> sz.segments;
+		in >> sz.corrections;
+		in >> sz.groups;
+		return in;
+	}
+};
+
+} // namespace sux::bits
@@ -0,0 +1,246 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2007-2020 Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "EliasFano.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <future>
+#include <memory>
+#include <vector>
+
+namespace sux::bits {
+
+using namespace std;
+using namespace sux;
+
+/** A set of keys over a sliding time window, partitioned by period.
+ *
+ * Keys are added together with a nondecreasing timestamp. Time is divided into periods
+ * of fixed length, and the keys of each period form a partition: the keys of the current
+ * period are added to a head (a few sorted runs and a small unsorted buffer, merged as in
+ * a log-structured merge tree), and when a key of a later period arrives the head is sealed,
+ * that is, turned into an immutable EliasFano instance by a background thread. Until sealing
+ * completes, queries are answered using the runs of the head.
+ *
+ * The oldest partition can be expired in constant time, without rebuilding anything, and
+ * range queries bounded in time only visit the partitions whose period overlaps the given
+ * time range. The time resolution of queries is thus a period.
+ *
+ * Instances are not thread-safe: the background threads only build the partitions, and
+ * all methods must be called by the same thread (or be externally synchronized).
+ *
+ * @tparam AT a type of memory allocation out of sux::util::AllocType.
+ */
+
+template <util::AllocType AT = util::AllocType::MALLOC> class RollingEliasFano {
+	// The keys of a period that has not been sealed yet: sorted runs of nonincreasing length, merged
+	// as in a binary counter, and a small unsorted buffer, so that both adding and searching are fast
+	struct Head {
+		static constexpr size_t buffer_size = 256;
+		std::vector<std::vector<uint64_t>> runs;
+		std::vector<uint64_t> buffer;
+
+		void add(const uint64_t key) {
+			buffer.push_back(key);
+			if (buffer.size() < buffer_size) return;
+			std::sort(buffer.begin(), buffer.end());
+			runs.push_back(std::move(buffer));
+			buffer = std::vector<uint64_t>();
+			while (runs.size() > 1 && runs[runs.size() - 2].size() <= runs.back().size()) {
+				auto &prev = runs[runs.size() - 2];
+				std::vector<uint64_t> merged(prev.size() + runs.back().size());
+				std::merge(prev.begin(), prev.end(), runs.back().begin(), runs.back().end(), merged.begin());
+				prev = std::move(merged);
+				runs.pop_back();
+			}
+		}
+
+		bool empty() const { return runs.empty() && buffer.empty(); }
+
+		bool empty(const uint64_t lo, const uint64_t hi) const {
+			for (const auto &run : runs) {
+				const auto it = std::lower_bound(run.begin(), run.end(), lo);
+				if (it != run.end() && *it <= hi) return false;
+			}
+			return std::none_of(buffer.begin(), buffer.end(), [&](const uint64_t k) { return k >= lo && k <= hi; });
+		}
+
+		// Returns all keys, sorted, merging the runs from the shortest to the longest
+		std::vector<uint64_t> sorted() const {
+			std::vector<uint64_t> keys(buffer);
+			std::sort(keys.begin(), keys.end());
+			for (auto run = runs.rbegin(); run != runs.rend(); ++run) {
+				std::vector<uint64_t> merged(keys.size() + run->size());
+				std::merge(keys.begin(), keys.end(), run->begin(), run->end(), merged.begin());
+				keys = std::move(merged);
+			}
+			return keys;
+		}
+
+		uint64_t bitCount() const {
+			uint64_t result = sizeof(*this) * 8 + buffer.capacity() * sizeof(uint64_t) * 8;
+			for (const auto &run : runs) result += sizeof(run) * 8 + run.capacity() * sizeof(uint64_t) * 8;
+			return result;
+		}
+	};
+
+	struct Partition {
+		// The first timestamp of the period
+		uint64_t start;
+		// The keys of the partition, until it has been sealed
+		std::shared_ptr<const Head> keys;
+		std::shared_future<EliasFano<AT>> sealed;
+
+		bool isSealed() const { return keys == nullptr || sealed.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+	};
+
+	uint64_t period;
+	uint64_t head_start;
+	Head head;
+	// Partitions, from the oldest to the newest
+	std::deque<Partition> partitions;
+	// The number of leading partitions whose keys have been dropped
+	size_t num_collected = 0;
+
+	static bool empty(const EliasFano<AT> &ef, const uint64_t lo, const uint64_t hi) {
+		if (ef.num_ones == 0 || lo >= ef.num_bits) return true;
+		const auto p = ef.predecessor(min(hi, ef.num_bits - 1));
+		return p.index() == SIZE_MAX || *p < lo;
+	}
+
+	// Drops the keys of the leading partitions whose sealing has completed
+	void collect() {
+		for (; num_collected < partitions.size() && partitions[num_collected].isSealed(); num_collected++) partitions[num_collected].keys.reset();
+	}
+
+	void pop_front() {
+		partitions.pop_front();
+		if (num_collected != 0) num_collected--;
+	}
+
+  public:
+	/** Creates a new empty instance.
+	 *
+	 * @param period the length of a period.
+	 * @param start the first timestamp of the first period.
+	 */
+	RollingEliasFano(const uint64_t period, const uint64_t start = 0) : period(period), head_start(start) { assert(period != 0); }
+
+	/** Adds a key.
+	 *
+	 * If the timestamp belongs to a period following the one of the head, the head is sealed first.
+	 *
+	 * @param time the timestamp of the key, which must not be smaller than the timestamps of the keys already added.
+	 * @param key a key.
+	 */
+	void add(const uint64_t time, const uint64_t key) {
+		assert(time >= head_start);
+		if (time - head_start >= period) {
+			seal();
+			head_start = time - (time - head_start) % period;
+		}
+		head.add(key);
+	}
+
+	/** Seals the head, if it is not empty, and starts a new (empty) head for the same period.
+	 *
+	 * The head is sorted and turned into an EliasFano instance in a background thread,
+	 * so this method does not wait for sealing to complete.
+	 */
+	void seal() {
+		collect();
+		if (head.empty()) return;
+		auto keys = std::make_shared<const Head>(std::move(head));
+		head = Head();
+		std::shared_future<EliasFano<AT>> sealed = std::async(std::launch::async, [keys] {
+			std::vector<uint64_t> sorted = keys->sorted();
+			return EliasFano<AT>(sorted.begin(), sorted.end(), true);
+		});
+		partitions.push_back({head_start, std::move(keys), std::move(sealed)});
+	}
+
+	/** Waits until all sealed partitions have been built. */
+	void sync() {
+		for (auto &p : partitions) p.sealed.wait();
+		collect();
+	}
+
+	/** Removes the oldest partition, if any, in constant time.
+	 *
+	 * The head is never expired; seal it first if necessary. If the partition is
+	 * still being sealed, this method waits for its background thread.
+	 */
+	void expire() {
+		if (!partitions.empty()) pop_front();
+	}
+
+	/** Removes all partitions whose period ends before a given timestamp.
+	 *
+	 * @param time a timestamp.
+	 */
+	void expireBefore(const uint64_t time) {
+		while (!partitions.empty() && partitions.front().start + period <= time) pop_front();
+	}
+
+	/** Returns the number of partitions, excluding the head. */
+	size_t numPartitions() const { return partitions.size(); }
+
+	/** Returns whether no key in a closed range has been added during the periods overlapping a closed time range.
+	 *
+	 * @param lo the lower end of the range of keys (included).
+	 * @param hi the upper end of the range of keys (included).
+	 * @param from the lower end of the range of timestamps (included).
+	 * @param to the upper end of the range of timestamps (included).
+	 * @return true if no key in [`lo`..`hi`] has been added in a period overlapping [`from`..`to`].
+	 */
+	bool emptyRange(const uint64_t lo, const uint64_t hi, const uint64_t from = 0, const uint64_t to = UINT64_MAX) const {
+		if (lo > hi || from > to) return true;
+		// The first partition whose period does not end before from
+		auto it = std::partition_point(partitions.begin(), partitions.end(), [&](const Partition &p) { return p.start + period <= from; });
+		for (; it != partitions.end() && it->start <= to; ++it) {
+			if (!(it->isSealed() ? empty(it->sealed.get(), lo, hi) : it->keys->empty(lo, hi))) return false;
+		}
+		return head_start > to || head_start + period <= from || head.empty(lo, hi);
+	}
+
+	/** Returns an estimate of the size in bits of this structure.
+	 *
+	 * Partitions that are still being sealed are counted as sorted runs of keys.
+	 */
+	uint64_t bitCount() const {
+		uint64_t result = sizeof(*this) * 8 + head.bitCount();
+		for (const auto &p : partitions) result += sizeof(p) * 8 + (p.isSealed() ? p.sealed.get().bitCount() : p.keys->bitCount());
+		return result;
+	}
+};
+
+} // namespace sux::bits
@@ -77,9 +77,11 @@ template <util::AllocType AT = util::AllocType::MALLOC> class SimpleSelectHalf {
 	 *
 	 * @param bits a bit vector of 64-bit words.
 	 * @param num_bits the length (in bits) of the bit vector.
+	 * @param alloc_type the type of allocation of the inventory, which must be AT unless AT is util::DYNAMIC.
 	 */
 
-	SimpleSelectHalf(const uint64_t *const bits, const uint64_t num_bits) : bits(bits) {
+	SimpleSelectHalf(const uint64_t *const bits, const uint64_t num_bits, util::AllocType alloc_type = util::Vector<int64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: bits(bits), inventory(alloc_type) {
 		num_words = (num_bits + 63) / 64;
 
 		// Init rank/select structure
@@ -166,7 +168,7 @@ template <util::AllocType AT = util::AllocType::MALLOC> class SimpleSelectHalf {
 #endif
 	}
 
-	uint64_t select(const uint64_t rank) {
+	uint64_t select(const uint64_t rank) const {
 #ifdef DEBUG
 		printf("Selecting %" PRId64 "\n...", rank);
 #endif
@@ -214,7 +216,7 @@ template <util::AllocType AT = util::AllocType::MALLOC> class SimpleSelectHalf {
 		return word_index * 64 + select64(word, residual);
 	}
 
-	uint64_t select(const uint64_t rank, uint64_t *const next) {
+	uint64_t select(const uint64_t rank, uint64_t *const next) const {
 		const uint64_t s = select(rank);
 		int curr = s / 64;
 
@@ -65,21 +65,38 @@ template <util::AllocType AT = util::AllocType::MALLOC> class SimpleSelectZeroHa
 	static const int zeros_per_sub16 = 1 << log2_zeros_per_sub16;
 	static const uint64_t zeros_per_sub16_mask = zeros_per_sub16 - 1;
 
-	const uint64_t *bits;
+	const uint64_t *bits = nullptr;
 	util::Vector<int64_t, AT> inventory;
 
-	uint64_t num_words, inventory_size, num_zeros;
+	uint64_t num_words = 0, inventory_size = 0, num_zeros = 0;
+
+	template <util::AllocType> friend class SimpleSelectZeroHalf;
 
   public:
 	SimpleSelectZeroHalf() {}
 
+	/** Creates a copy of an instance with a different type of memory allocation.
+	 *
+	 * The inventory is copied, not rebuilt, and the new instance is bound to a given
+	 * bit vector, which must have the same content as that of the copied instance.
+	 *
+	 * @param oth the instance to copy.
+	 * @param bits a bit vector of 64-bit words with the same content as the one `oth` was built on.
+	 * @param alloc_type the type of allocation of the inventory, which must be AT unless AT is util::DYNAMIC.
+	 */
+	template <util::AllocType AT2>
+	explicit SimpleSelectZeroHalf(const SimpleSelectZeroHalf<AT2> &oth, const uint64_t *const bits, util::AllocType alloc_type = util::Vector<int64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: bits(bits), inventory(oth.inventory, alloc_type), num_words(oth.num_words), inventory_size(oth.inventory_size), num_zeros(oth.num_zeros) {}
+
 	/** Creates a new instance using a given bit vector.
 	 *
 	 * @param bits a bit vector of 64-bit words.
 	 * @param num_bits the length (in bits) of the bit vector.
+	 * @param alloc_type the type of allocation of the inventory, which must be AT unless AT is util::DYNAMIC.
 	 */
 
-	SimpleSelectZeroHalf(const uint64_t *const bits, const uint64_t num_bits) : bits(bits) {
+	SimpleSelectZeroHalf(const uint64_t *const bits, const uint64_t num_bits, util::AllocType alloc_type = util::Vector<int64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: bits(bits), inventory(alloc_type) {
 		num_words = (num_bits + 63) / 64;
 
 		// Init rank/select structure
@@ -214,11 +231,20 @@ template <util::AllocType AT = util::AllocType::MALLOC> class SimpleSelectZeroHa
 		return word_index * 64 + select64(word, residual);
 	}
 
+	/** Prefetches the part of the inventory used by selectZero() for a given rank.
+	 *
+	 * @param rank a rank smaller than the number of zeros.
+	 */
+	void prefetch(const uint64_t rank) const {
+		const uint64_t inventory_index = rank >> log2_zeros_per_inventory;
+		__builtin_prefetch(&inventory + (inventory_index << log2_longwords_per_subinventory) + inventory_index);
+	}
+
 	uint64_t selectZero(const uint64_t rank, uint64_t *const next) const {
 		const uint64_t s = selectZero(rank);
-		int curr = s / 64;
+		uint64_t curr = s / 64;
 
-		uint64_t window = ~bits[curr] & -1ULL << s;
+		uint64_t window = ~bits[curr] & -1ULL << s % 64;
 		window &= window - 1;
 
 		while (window == 0) window = ~bits[++curr];
@@ -230,6 +256,112 @@ template <util::AllocType AT = util::AllocType::MALLOC> class SimpleSelectZeroHa
 	/** Returns an estimate of the size (in bits) of this structure. */
 	size_t bitCount() const { return inventory.bitCount() - sizeof(inventory) * 8 + sizeof(*this) * 8; };
 
+	/** Advises the kernel about the expected access pattern to the inventory.
+	 *
+	 * The bit vector is not affected, as it is not owned by this structure.
+	 *
+	 * @param hint the expected access pattern.
+	 * @return true if the hint was accepted by the kernel.
+	 */
+	bool advise(util::AccessHint hint) const { return inventory.advise(hint); }
+
+	/** Checks the consistency of this structure.
+	 *
+	 * The basic check verifies that the sizes of the inventory are consistent with
+	 * each other and with the length of the bit vector, and, with a pass over the
+	 * inventory (which is small compared to the bit vector), that all inventory spans
+	 * start inside the bit vector. The deep check also recounts the zeros of the bit
+	 * vector and verifies, in a single streaming pass, that every inventory entry points
+	 * to the zero of the correct rank.
+	 *
+	 * Only the deep check guarantees that selectZero() does not read past the end of
+	 * a corrupted bit vector, as the scan following an inventory entry relies on the
+	 * zeros promised by the entry.
+	 *
+	 * @param num_bits the length (in bits) of the bit vector this structure should index.
+	 * @param deep whether to perform the deep check.
+	 * @return true if this structure is consistent.
+	 */
+	bool validate(const uint64_t num_bits, const bool deep = false) const {
+		if (num_words != (num_bits + 63) / 64 || num_zeros > num_words * 64 || num_zeros < num_words * 64 - num_bits) return false;
+		if (num_words != 0 && bits == nullptr) return false;
+		const uint64_t c = num_zeros - (num_words * 64 - num_bits); // Indexed zeros
+		if (inventory_size != (c + zeros_per_inventory - 1) / zeros_per_inventory) return false;
+		if (inventory.size() != inventory_size * (longwords_per_subinventory + 1) + 1) return false;
+		if (uint64_t(inventory[inventory_size * (longwords_per_subinventory + 1)]) != num_bits) return false;
+
+		// Every span must start inside the bit vector (unused entries are zero); arithmetic is
+		// unsigned, as entries might be corrupted
+		for (uint64_t i = 0; i < inventory_size; i++) {
+			const int64_t *const inventory_start = &inventory + i * (longwords_per_subinventory + 1);
+			const int64_t inventory_rank = *inventory_start;
+			if (inventory_rank >= 0) {
+				if (uint64_t(inventory_rank) >= num_bits) return false;
+				const uint16_t *const p16 = (const uint16_t *)(inventory_start + 1);
+				for (int j = 0; j < longwords_per_subinventory * 4; j++)
+					if (p16[j] >= num_bits - inventory_rank) return false;
+			} else {
+				const uint64_t start = ~uint64_t(inventory_rank);
+				if (start >= num_bits) return false;
+				for (int j = 0; j < longwords_per_subinventory; j++)
+					if (uint64_t(inventory_start[1 + j]) >= num_bits - start) return false;
+			}
+		}
+
+		if (!deep) return true;
+
+		if (num_words * 64 - nu(bits, num_words) != num_zeros) return false;
+
+		// Check the entries of the inventory, which sample zeros of rank multiple of zeros_per_sub16
+		uint64_t d = 0;
+		for (uint64_t i = 0; i < num_words; i++) {
+			uint64_t zeros = ~bits[i];
+			if ((i + 1) * 64 > num_bits) zeros &= (1ULL << num_bits % 64) - 1;
+			const uint64_t count = nu(zeros);
+
+			for (uint64_t s = (d + zeros_per_sub16_mask) & ~zeros_per_sub16_mask; s < d + count; s += zeros_per_sub16) {
+				const uint64_t pos = i * 64 + select64(zeros, s - d);
+				const int64_t *const inventory_start = &inventory + (s >> log2_zeros_per_inventory) * (longwords_per_subinventory + 1);
+				const int64_t inventory_rank = *inventory_start;
+				const uint64_t subrank = s & zeros_per_inventory_mask;
+
+				if (inventory_rank >= 0) {
+					if (uint64_t(inventory_rank) + ((uint16_t *)(inventory_start + 1))[subrank >> log2_zeros_per_sub16] != pos) return false;
+				} else if ((subrank & zeros_per_sub64_mask) == 0) {
+					// Arithmetic is unsigned, as entries might be corrupted
+					if (~uint64_t(inventory_rank) + uint64_t(*(inventory_start + 1 + (subrank >> log2_zeros_per_sub64))) != pos) return false;
+				}
+			}
+
+			d += count;
+		}
+
+		return d == c;
+	}
+
+	/** Applies a function to the scalar fields and to the inventory of this structure.
+	 *
+	 * This method makes it possible to write generic serialization code. The bit vector
+	 * is not visited: after reconstructing an instance it must be set with rebind().
+	 *
+	 * @param f a function accepting a reference to a `uint64_t` or to a util::Vector.
+	 */
+	template <class F> void visit(F &&f) {
+		f(num_words);
+		f(inventory_size);
+		f(num_zeros);
+		f(inventory);
+	}
+
+	/** Const version of visit(F &&). */
+	template <class F> void visit(F &&f) const { const_cast<SimpleSelectZeroHalf *>(this)->visit(f); }
+
+	/** Sets the bit vector used by this structure, without rebuilding the inventory.
+	 *
+	 * @param bits a bit vector of 64-bit words with the same content as the one this instance was built on.
+	 */
+	void rebind(const uint64_t *const bits) { this->bits = bits; }
+
     friend std::ostream &operator<<(std::ostream &out, const SimpleSelectZeroHalf<AT> &sz)
     {
         out.write(reinterpret_cast<const char *>(&sz.num_words), sizeof(sz.num_words));
@@ -244,9 +376,9 @@ template <util::AllocType AT = util::AllocType::MALLOC> class SimpleSelectZeroHa
         in.read(reinterpret_cast<char *>(&sz.num_words), sizeof(sz.num_words));
         in.read(reinterpret_cast<char *>(&sz.inventory_size), sizeof(sz.inventory_size));
         in.read(reinterpret_cast<char *>(&sz.num_zeros), sizeof(sz.num_zeros));
-        auto temp = new uint64_t[sz.num_words];
-        in.read(reinterpret_cast<char *>(temp), sz.num_words * sizeof(*sz.bits));
-        sz.bits = temp;
+        // The bit vector is owned by the caller, which must rebind() it after reading
+        in.ignore(sz.num_words * sizeof(*sz.bits));
+        sz.bits = nullptr;
         in >> sz.inventory;
         return in;
     }
@@ -0,0 +1,318 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2007-2020 Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../support/common.hpp"
+#include "../util/Vector.hpp"
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+namespace sux::bits {
+
+using namespace std;
+using namespace sux;
+
+/** A SelectZero implementation with a small top-level directory.
+ *
+ * The inventory of SimpleSelectZeroHalf is a single array of about 1/3 of a bit
+ * per zero, so on very long bit vectors its entries are almost never in cache. This
+ * class splits the inventory in two levels: the top level records the position of the
+ * zeros of rank multiple of 2<sup>14</sup> in 64 bits, and takes less than 1/200 of a bit per zero
+ * (a few hundred kilobytes for a billion zeros), so that it stays in the cache and in
+ * the TLB reach; the second level records, for each zero of rank multiple of 64, its
+ * 16-bit offset from the position in the top level. The 256 offsets of a top-level block
+ * are contiguous, and since an offset never straddles a cache line, the second level
+ * costs at most one cache miss, after which at most 63 zeros are scanned with popcounts,
+ * as in SimpleSelectZeroHalf.
+ *
+ * Blocks spanning 2<sup>16</sup> positions or more (e.g., containing a huge bucket of an EliasFano
+ * instance) are marked in the top level, and their second level is replaced by 256
+ * absolute positions in a separate array.
+ *
+ * The constructors of this class only store a reference
+ * to a provided bit vector. Should the content of the
+ * bit vector change, the results will be unpredictable.
+ *
+ * This class can be used as selectZero structure of EliasFano in place of SimpleSelectZeroHalf.
+ *
+ * @tparam AT a type of memory allocation out of sux::util::AllocType.
+ */
+
+template <util::AllocType AT = util::AllocType::MALLOC> class TwoLevelSelectZero {
+  private:
+	static const int log2_zeros_per_slot = 6;
+	static const int log2_zeros_per_block = 14;
+	static const int log2_slots_per_block = log2_zeros_per_block - log2_zeros_per_slot;
+	static const uint64_t zeros_per_slot_mask = (1ULL << log2_zeros_per_slot) - 1;
+	static const uint64_t slots_per_block = 1ULL << log2_slots_per_block;
+	// Second-level words per block: slots are 16-bit offsets
+	static const int log2_words_per_block = log2_slots_per_block - 2;
+	static const uint64_t sparse = 1ULL << 63;
+
+	const uint64_t *bits = nullptr;
+	// For each block, the position of its first zero, possibly marked as sparse
+	util::Vector<uint64_t, AT> top;
+	// For each dense block, the offsets of its sampled zeros from its first zero, packed in 16 bits;
+	// for each sparse block, the index of its first sampled position in spill
+	util::Vector<uint64_t, AT> slots;
+	// The positions of the sampled zeros of sparse blocks
+	util::Vector<uint64_t, AT> spill;
+
+	uint64_t num_words = 0, num_zeros = 0, num_blocks = 0;
+
+	template <util::AllocType> friend class TwoLevelSelectZero;
+
+	// Stores the positions of the sampled zeros of a block
+	void add_block(const uint64_t block, const uint64_t *const pos, const uint64_t n) {
+		if (pos[n - 1] - pos[0] < (1 << 16)) {
+			top[block] = pos[0];
+			uint16_t *const offsets = reinterpret_cast<uint16_t *>(&slots + (block << log2_words_per_block));
+			for (uint64_t i = 0; i < n; i++) offsets[i] = pos[i] - pos[0];
+		} else {
+			top[block] = pos[0] | sparse;
+			slots[block << log2_words_per_block] = spill.size();
+			for (uint64_t i = 0; i < slots_per_block; i++) spill.pushBack(pos[min(i, n - 1)]);
+		}
+	}
+
+	// Calls f(rank, pos) for each indexed zero of rank multiple of 64
+	template <class F> void for_each_sample(const uint64_t num_bits, F &&f) const {
+		for (uint64_t i = 0, d = 0; i < num_words; i++) {
+			uint64_t zeros = ~bits[i];
+			if ((i + 1) * 64 > num_bits) zeros &= (1ULL << num_bits % 64) - 1;
+			const uint64_t count = nu(zeros);
+			for (uint64_t s = (d + zeros_per_slot_mask) & ~zeros_per_slot_mask; s < d + count; s += 1 << log2_zeros_per_slot) f(s, i * 64 + select64(zeros, s - d));
+			d += count;
+		}
+	}
+
+  public:
+	TwoLevelSelectZero() {}
+
+	/** Creates a copy of an instance with a different type of memory allocation.
+	 *
+	 * The inventory is copied, not rebuilt, and the new instance is bound to a given
+	 * bit vector, which must have the same content as that of the copied instance.
+	 *
+	 * @param oth the instance to copy.
+	 * @param bits a bit vector of 64-bit words with the same content as the one `oth` was built on.
+	 * @param alloc_type the type of allocation of the inventory, which must be AT unless AT is util::DYNAMIC.
+	 */
+	template <util::AllocType AT2>
+	explicit TwoLevelSelectZero(const TwoLevelSelectZero<AT2> &oth, const uint64_t *const bits, util::AllocType alloc_type = util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: bits(bits), top(oth.top, alloc_type), slots(oth.slots, alloc_type), spill(oth.spill, alloc_type), num_words(oth.num_words), num_zeros(oth.num_zeros),
+		  num_blocks(oth.num_blocks) {}
+
+	/** Creates a new instance using a given bit vector.
+	 *
+	 * @param bits a bit vector of 64-bit words.
+	 * @param num_bits the length (in bits) of the bit vector.
+	 * @param alloc_type the type of allocation of the inventory, which must be AT unless AT is util::DYNAMIC.
+	 */
+	TwoLevelSelectZero(const uint64_t *const bits, const uint64_t num_bits, util::AllocType alloc_type = util::Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: bits(bits), top(alloc_type), slots(alloc_type), spill(alloc_type) {
+		num_words = (num_bits + 63) / 64;
+
+		uint64_t c = 0;
+		for (uint64_t i = 0; i < num_words; i++) c += __builtin_popcountll(~bits[i]);
+		num_zeros = c;
+
+		if (num_bits % 64 != 0) c -= 64 - num_bits % 64;
+		assert(c <= num_bits);
+
+		num_blocks = (c + (1ULL << log2_zeros_per_block) - 1) >> log2_zeros_per_block;
+		top.size(num_blocks);
+		slots.size(num_blocks << log2_words_per_block);
+
+		uint64_t pos[slots_per_block], n = 0;
+		for_each_sample(num_bits, [&](const uint64_t rank, const uint64_t p) {
+			pos[n++] = p;
+			if (n == slots_per_block) {
+				add_block(rank >> log2_zeros_per_block, pos, n);
+				n = 0;
+			}
+		});
+		if (n != 0) add_block(num_blocks - 1, pos, n);
+		spill.trimToFit();
+	}
+
+	uint64_t selectZero(const uint64_t rank) const {
+		assert(rank < num_zeros);
+
+		const uint64_t block = rank >> log2_zeros_per_block, slot = rank >> log2_zeros_per_slot;
+		const uint64_t t = top[block];
+		uint64_t start;
+		if ((t & sparse) == 0) {
+			start = t + reinterpret_cast<const uint16_t *>(&slots)[slot];
+		} else {
+			// The index is clamped, so that corrupted instances do not read out of bounds
+			start = spill.size() == 0 ? t & ~sparse : spill[min(slots[block << log2_words_per_block], spill.size() - slots_per_block) + (slot & (slots_per_block - 1))];
+		}
+
+		int residual = rank & zeros_per_slot_mask;
+		if (residual == 0) return start;
+
+		uint64_t word_index = start / 64;
+		uint64_t word = ~bits[word_index] & -1ULL << start % 64;
+
+		for (;;) {
+			const int bit_count = __builtin_popcountll(word);
+			if (residual < bit_count) break;
+			word = ~bits[++word_index];
+			residual -= bit_count;
+		}
+
+		return word_index * 64 + select64(word, residual);
+	}
+
+	/** Prefetches the part of the second level used by selectZero() for a given rank.
+	 *
+	 * @param rank a rank smaller than the number of zeros.
+	 */
+	void prefetch(const uint64_t rank) const { __builtin_prefetch(reinterpret_cast<const uint16_t *>(&slots) + (rank >> log2_zeros_per_slot)); }
+
+	uint64_t selectZero(const uint64_t rank, uint64_t *const next) const {
+		const uint64_t s = selectZero(rank);
+		uint64_t curr = s / 64;
+
+		uint64_t window = ~bits[curr] & -1ULL << s % 64;
+		window &= window - 1;
+
+		while (window == 0) window = ~bits[++curr];
+		*next = curr * 64 + __builtin_ctzll(window);
+
+		return s;
+	}
+
+	/** Returns the number of top-level blocks whose positions are stored in 64 bits. */
+	size_t numSparseBlocks() const { return spill.size() / slots_per_block; }
+
+	/** Returns the size in bits of the top level, which should stay in cache. */
+	size_t topBitCount() const { return top.bitCount() - sizeof(top) * 8; }
+
+	/** Returns an estimate of the size (in bits) of this structure. */
+	size_t bitCount() const {
+		return top.bitCount() - sizeof(top) * 8 + slots.bitCount() - sizeof(slots) * 8 + spill.bitCount() - sizeof(spill) * 8 + sizeof(*this) * 8;
+	};
+
+	/** Advises the kernel about the expected access pattern to the inventory.
+	 *
+	 * The bit vector is not affected, as it is not owned by this structure.
+	 *
+	 * @param hint the expected access pattern.
+	 * @return true if the hint was accepted by the kernel.
+	 */
+	bool advise(util::AccessHint hint) const {
+		bool result = top.advise(hint);
+		result &= slots.advise(hint);
+		return spill.advise(hint) && result;
+	}
+
+	/** Checks the consistency of this structure.
+	 *
+	 * The basic check, which takes constant time, verifies that the sizes of
+	 * the levels are consistent with each other and with the length of the
+	 * bit vector. The deep check also recounts the zeros of the bit vector and
+	 * verifies, in a single streaming pass, that every sampled zero is located correctly.
+	 *
+	 * @param num_bits the length (in bits) of the bit vector this structure should index.
+	 * @param deep whether to perform the deep check.
+	 * @return true if this structure is consistent.
+	 */
+	bool validate(const uint64_t num_bits, const bool deep = false) const {
+		if (num_words != (num_bits + 63) / 64 || num_zeros > num_words * 64 || num_zeros < num_words * 64 - num_bits) return false;
+		if (num_words != 0 && bits == nullptr) return false;
+		const uint64_t c = num_zeros - (num_words * 64 - num_bits); // Indexed zeros
+		if (num_blocks != (c + (1ULL << log2_zeros_per_block) - 1) >> log2_zeros_per_block) return false;
+		if (top.size() != num_blocks || slots.size() != num_blocks << log2_words_per_block || spill.size() % slots_per_block != 0) return false;
+		if (!deep) return true;
+
+		if (num_words * 64 - nu(bits, num_words) != num_zeros) return false;
+
+		uint64_t num_sparse = 0;
+		for (uint64_t b = 0; b < num_blocks; b++)
+			if (top[b] & sparse) {
+				if (slots[b << log2_words_per_block] != num_sparse * slots_per_block) return false;
+				num_sparse++;
+			}
+		if (num_sparse * slots_per_block != spill.size()) return false;
+
+		bool ok = true;
+		for_each_sample(num_bits, [&](const uint64_t rank, const uint64_t p) { ok &= selectZero(rank) == p; });
+		return ok;
+	}
+
+	/** Applies a function to the scalar fields and to the inventory of this structure.
+	 *
+	 * This method makes it possible to write generic serialization code. The bit vector
+	 * is not visited: after reconstructing an instance it must be set with rebind().
+	 *
+	 * @param f a function accepting a reference to a `uint64_t` or to a util::Vector.
+	 */
+	template <class F> void visit(F &&f) {
+		f(num_words);
+		f(num_zeros);
+		f(num_blocks);
+		f(top);
+		f(slots);
+		f(spill);
+	}
+
+	/** Const version of visit(F &&). */
+	template <class F> void visit(F &&f) const { const_cast<TwoLevelSelectZero *>(this)->visit(f); }
+
+	/** Sets the bit vector used by this structure, without rebuilding the inventory.
+	 *
+	 * @param bits a bit vector of 64-bit words with the same content as the one this instance was built on.
+	 */
+	void rebind(const uint64_t *const bits) { this->bits = bits; }
+
+	friend std::ostream &operator<<(std::ostream &out, const TwoLevelSelectZero<AT> &sz) {
+		out.write(reinterpret_cast<const char *>(&sz.num_words), sizeof(sz.num_words));
+		out.write(reinterpret_cast<const char *>(&sz.num_zeros), sizeof(sz.num_zeros));
+		out.write(reinterpret_cast<const char *>(&sz.num_blocks), sizeof(sz.num_blocks));
+		out << sz.top;
+		out << sz.slots;
+		out << sz.spill;
+		return out;
+	}
+
+	friend std::istream &operator>>(std::istream &in, TwoLevelSelectZero<AT> &sz) {
+		in.read(reinterpret_cast<char *>(&sz.num_words), sizeof(sz.num_words));
+		in.read(reinterpret_cast<char *>(&sz.num_zeros), sizeof(sz.num_zeros));
+		in.read(reinterpret_cast<char *>(&sz.num_blocks), sizeof(sz.num_blocks));
+		in >> sz.top;
+		in >> sz.slots;
+		in >> sz.spill;
+		return in;
+	}
+};
+
+} // namespace sux::bits
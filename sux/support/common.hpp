@@ -341,6 +341,19 @@ inline void bitwrite_inc(void *const word, int from, int length, uint64_t inc) {
  */
 inline int nu(uint64_t word) { return __builtin_popcountll(word); }
 
+/** Count the number of 1-bits in an array of words.
+ * @param words an array of binary words.
+ * @param n the number of words.
+ *
+ * This plain loop is faster than the AVX2 nibble-lookup algorithm: compilers turn it into
+ * hardware popcounts, or into vector popcounts when the target has them.
+ */
+inline uint64_t nu(const uint64_t *words, size_t n) {
+	uint64_t result = 0;
+	for (size_t i = 0; i < n; i++) result += nu(words[i]);
+	return result;
+}
+
 /** Return a number rounded to the desired power of two multiple.
  * @param number value to round up.
  * @param multiple power of two to which you want to round `number`.
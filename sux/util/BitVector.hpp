@@ -0,0 +1,419 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2019-2020 Stefano Marchini and Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include "../bits/SimpleSelectHalf.hpp"
+#include "../bits/SimpleSelectZeroHalf.hpp"
+#include "../support/common.hpp"
+#include "Vector.hpp"
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace sux::util {
+
+/** An owning, modifiable bit vector with rank and select support.
+ *
+ * Bits are stored in a Vector of 64-bit words, in little-endian order (bit _i_ is
+ * bit _i_ mod 64 of word _i_ / 64); bits of the last word beyond size() are always zero.
+ *
+ * Instances maintain a rank index (one cumulative count for every 512 bits) and two
+ * selectors, one on ones and one on zeros, of the given classes. The indices are never
+ * updated by modifications: modifications just record the range of words they touched,
+ * and the indices are brought up to date by the next query that needs them (or by update()).
+ * The rank index is rebuilt incrementally, recounting only the blocks that have been
+ * touched and adjusting the counts following them; selectors are rebuilt from scratch,
+ * and only when select() or selectZero() is actually called.
+ *
+ * Bulk operations (AND, OR, XOR and AND NOT of whole vectors, counting, and range setting
+ * and clearing) are plain loops over words, which compilers vectorize.
+ *
+ * Queries come in two flavors. The non-const ones bring the indices they need up to date,
+ * so they modify the instance: like modifications, they must not be called concurrently
+ * by several threads. The const ones require the indices to be up to date, that is,
+ * update() must have been called after the last modification; they can then be called
+ * concurrently, also through a `const BitVector &`.
+ *
+ * @tparam AT a type of memory allocation out of ::AllocType.
+ * @tparam S a selection structure on ones, built from a bit vector like bits::SimpleSelectHalf.
+ * @tparam SZ a selection structure on zeros, built from a bit vector like bits::SimpleSelectZeroHalf.
+ */
+
+template <AllocType AT = MALLOC, template <AllocType> class S = bits::SimpleSelectHalf, template <AllocType> class SZ = bits::SimpleSelectZeroHalf> class BitVector {
+	static constexpr int log2_words_per_block = 3;
+	static constexpr uint64_t words_per_block = 1 << log2_words_per_block;
+
+	uint64_t num_bits = 0;
+	Vector<uint64_t, AT> bits;
+	// The number of ones before each block of the rank index, plus the total number of ones
+	Vector<uint64_t, AT> counts;
+	// The range of blocks of the rank index that must be recounted (empty if dirty_lo >= dirty_hi)
+	uint64_t dirty_lo = 0, dirty_hi = 0;
+	S<AT> select_ones;
+	SZ<AT> select_zeros;
+	bool select_ones_valid = false, select_zeros_valid = false;
+
+	uint64_t num_blocks() const { return (bits.size() + words_per_block - 1) / words_per_block; }
+
+	// Records that the words in [from..to) have been modified
+	void invalidate(const uint64_t from, const uint64_t to) {
+		if (from >= to) return;
+		const uint64_t lo = from >> log2_words_per_block, hi = ((to - 1) >> log2_words_per_block) + 1;
+		if (dirty_lo >= dirty_hi) {
+			dirty_lo = lo;
+			dirty_hi = hi;
+		} else {
+			dirty_lo = min(dirty_lo, lo);
+			dirty_hi = max(dirty_hi, hi);
+		}
+		select_ones_valid = select_zeros_valid = false;
+	}
+
+	uint64_t block_count(const uint64_t b) const {
+		const uint64_t from = b * words_per_block;
+		return nu(&bits + from, min(words_per_block, bits.size() - from));
+	}
+
+	void update_rank() {
+		const uint64_t n = num_blocks();
+		if (counts.size() != n + 1) {
+			counts.size(n + 1);
+			counts[0] = 0;
+			for (uint64_t b = 0; b < n; b++) counts[b + 1] = counts[b] + block_count(b);
+		} else if (dirty_lo < dirty_hi) {
+			const uint64_t old_end = counts[dirty_hi];
+			for (uint64_t b = dirty_lo; b < dirty_hi; b++) counts[b + 1] = counts[b] + block_count(b);
+			// The counts following the touched blocks just shift (modulo 2^64)
+			const uint64_t delta = counts[dirty_hi] - old_end;
+			if (delta != 0)
+				for (uint64_t b = dirty_hi + 1; b <= n; b++) counts[b] += delta;
+		}
+		dirty_lo = dirty_hi = 0;
+	}
+
+	// Sets the bits in [from..to) to value
+	void fill(const uint64_t from, const uint64_t to, const bool value) {
+		assert(from <= to && to <= num_bits);
+		if (from == to) return;
+		const uint64_t first = from / 64, last = (to - 1) / 64;
+		// Masks of the bits in range of the first and last word
+		const uint64_t head = -1ULL << from % 64, tail = -1ULL >> (63 - (to - 1) % 64);
+		if (first == last) {
+			if (value) bits[first] |= head & tail;
+			else bits[first] &= ~(head & tail);
+		} else {
+			if (value) bits[first] |= head;
+			else bits[first] &= ~head;
+			// memset() is vectorized, and does not touch the first and last word
+			memset(&bits + first + 1, value ? 0xFF : 0, (last - first - 1) * sizeof(uint64_t));
+			if (value) bits[last] |= tail;
+			else bits[last] &= ~tail;
+		}
+		invalidate(first, last + 1);
+	}
+
+  public:
+	/** Creates a new bit vector with all bits set to zero.
+	 *
+	 * @param num_bits the length (in bits) of the bit vector.
+	 * @param alloc_type the type of allocation, which must be AT unless AT is ::DYNAMIC.
+	 */
+	explicit BitVector(const uint64_t num_bits = 0, AllocType alloc_type = Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: bits(alloc_type), counts(alloc_type) {
+		resize(num_bits);
+	}
+
+	/** Creates a new bit vector containing a copy of an array of words.
+	 *
+	 * @param words a bit vector of 64-bit words.
+	 * @param num_bits the length (in bits) of the bit vector.
+	 * @param alloc_type the type of allocation, which must be AT unless AT is ::DYNAMIC.
+	 */
+	BitVector(const uint64_t *const words, const uint64_t num_bits, AllocType alloc_type = Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: BitVector(num_bits, alloc_type) {
+		if (num_bits == 0) return;
+		memcpy(&bits, words, bits.size() * sizeof(uint64_t));
+		if (num_bits % 64 != 0) bits[bits.size() - 1] &= (1ULL << num_bits % 64) - 1;
+		invalidate(0, bits.size());
+	}
+
+	/** Creates a copy of a bit vector with a different type of memory allocation.
+	 *
+	 * Indices are not copied, and they will be rebuilt when needed.
+	 *
+	 * @param oth the bit vector to copy.
+	 * @param alloc_type the type of allocation of the copy, which must be AT unless AT is ::DYNAMIC.
+	 */
+	template <AllocType AT2, template <AllocType> class S2, template <AllocType> class SZ2>
+	explicit BitVector(const BitVector<AT2, S2, SZ2> &oth, AllocType alloc_type = Vector<uint64_t, AT>::DEFAULT_ALLOC_TYPE)
+		: BitVector(oth.words(), oth.size(), alloc_type) {}
+
+	/** Returns the length (in bits) of this bit vector. */
+	uint64_t size() const { return num_bits; }
+
+	/** Returns a pointer to the words of this bit vector, which can be used to build other structures.
+	 *
+	 * The pointer is invalidated by resize(uint64_t), and the content of the words by all modifications.
+	 */
+	const uint64_t *words() const { return &bits; }
+
+	/** Changes the length of this bit vector; new bits are set to zero.
+	 *
+	 * @param num_bits the new length (in bits).
+	 */
+	void resize(const uint64_t num_bits) {
+		const uint64_t old_words = bits.size(), new_words = (num_bits + 63) / 64;
+		bits.resize(new_words);
+		// Words that were in use before a shrink are not zeroed by Vector
+		if (new_words > old_words) memset(&bits + old_words, 0, (new_words - old_words) * sizeof(uint64_t));
+		if (num_bits % 64 != 0) bits[new_words - 1] &= (1ULL << num_bits % 64) - 1;
+		this->num_bits = num_bits;
+		// The number of blocks might have changed, so the rank index is rebuilt from scratch
+		counts.size(0);
+		dirty_lo = dirty_hi = 0;
+		select_ones_valid = select_zeros_valid = false;
+	}
+
+	/** Returns the value of a bit.
+	 *
+	 * @param pos a position smaller than size().
+	 */
+	bool operator[](const uint64_t pos) const {
+		assert(pos < num_bits);
+		return bits[pos / 64] >> pos % 64 & 1;
+	}
+
+	/** Sets a bit to a given value.
+	 *
+	 * @param pos a position smaller than size().
+	 * @param value the new value of the bit.
+	 */
+	void set(const uint64_t pos, const bool value = true) {
+		assert(pos < num_bits);
+		if (value) bits[pos / 64] |= 1ULL << pos % 64;
+		else bits[pos / 64] &= ~(1ULL << pos % 64);
+		invalidate(pos / 64, pos / 64 + 1);
+	}
+
+	/** Sets a bit to zero.
+	 *
+	 * @param pos a position smaller than size().
+	 */
+	void clear(const uint64_t pos) { set(pos, false); }
+
+	/** Sets to one all bits in a range.
+	 *
+	 * @param from the starting position (included).
+	 * @param to the ending position (excluded), at most size().
+	 */
+	void setRange(const uint64_t from, const uint64_t to) { fill(from, to, true); }
+
+	/** Sets to zero all bits in a range.
+	 *
+	 * @param from the starting position (included).
+	 * @param to the ending position (excluded), at most size().
+	 */
+	void clearRange(const uint64_t from, const uint64_t to) { fill(from, to, false); }
+
+	/** Sets this bit vector to its AND with another bit vector of the same length. */
+	template <AllocType AT2, template <AllocType> class S2, template <AllocType> class SZ2> BitVector &operator&=(const BitVector<AT2, S2, SZ2> &oth) {
+		assert(oth.size() == num_bits);
+		const uint64_t *const w = oth.words();
+		for (size_t i = 0; i < bits.size(); i++) bits[i] &= w[i];
+		invalidate(0, bits.size());
+		return *this;
+	}
+
+	/** Sets this bit vector to its OR with another bit vector of the same length. */
+	template <AllocType AT2, template <AllocType> class S2, template <AllocType> class SZ2> BitVector &operator|=(const BitVector<AT2, S2, SZ2> &oth) {
+		assert(oth.size() == num_bits);
+		const uint64_t *const w = oth.words();
+		for (size_t i = 0; i < bits.size(); i++) bits[i] |= w[i];
+		invalidate(0, bits.size());
+		return *this;
+	}
+
+	/** Sets this bit vector to its XOR with another bit vector of the same length. */
+	template <AllocType AT2, template <AllocType> class S2, template <AllocType> class SZ2> BitVector &operator^=(const BitVector<AT2, S2, SZ2> &oth) {
+		assert(oth.size() == num_bits);
+		const uint64_t *const w = oth.words();
+		for (size_t i = 0; i < bits.size(); i++) bits[i] ^= w[i];
+		invalidate(0, bits.size());
+		return *this;
+	}
+
+	/** Clears the bits of this bit vector that are set in another bit vector of the same length.
+	 *
+	 * This is the typical way of applying a bitmap of deleted items (tombstones).
+	 */
+	template <AllocType AT2, template <AllocType> class S2, template <AllocType> class SZ2> BitVector &andNot(const BitVector<AT2, S2, SZ2> &oth) {
+		assert(oth.size() == num_bits);
+		const uint64_t *const w = oth.words();
+		for (size_t i = 0; i < bits.size(); i++) bits[i] &= ~w[i];
+		invalidate(0, bits.size());
+		return *this;
+	}
+
+	/** Returns the number of ones in this bit vector. */
+	uint64_t count() const { return nu(&bits, bits.size()); }
+
+	/** Returns the number of ones in a range, without using the rank index.
+	 *
+	 * @param from the starting position (included).
+	 * @param to the ending position (excluded), at most size().
+	 */
+	uint64_t count(const uint64_t from, const uint64_t to) const {
+		assert(from <= to && to <= num_bits);
+		if (from == to) return 0;
+		const uint64_t first = from / 64, last = (to - 1) / 64;
+		const uint64_t head = -1ULL << from % 64, tail = -1ULL >> (63 - (to - 1) % 64);
+		if (first == last) return nu(bits[first] & head & tail);
+		return nu(bits[first] & head) + nu(&bits + first + 1, last - first - 1) + nu(bits[last] & tail);
+	}
+
+	/** Brings the rank index and the selectors up to date.
+	 *
+	 * Non-const queries do this automatically, but calling this method after a batch of
+	 * modifications moves the cost out of the first query, and it is necessary to use the
+	 * const queries (for example, from several threads).
+	 */
+	void update() {
+		update_rank();
+		if (!select_ones_valid) {
+			select_ones = S<AT>(&bits, num_bits, bits.allocType());
+			select_ones_valid = true;
+		}
+		if (!select_zeros_valid) {
+			select_zeros = SZ<AT>(&bits, num_bits, bits.allocType());
+			select_zeros_valid = true;
+		}
+	}
+
+	/** Returns the number of ones before a given position, bringing the rank index up to date if necessary.
+	 *
+	 * @param pos a position from 0 to size() (included).
+	 */
+	uint64_t rank(const uint64_t pos) {
+		if (dirty_lo < dirty_hi || counts.size() != num_blocks() + 1) update_rank();
+		return std::as_const(*this).rank(pos);
+	}
+
+	/** Returns the number of ones before a given position; update() must have been called after the last modification.
+	 *
+	 * @param pos a position from 0 to size() (included).
+	 */
+	uint64_t rank(const uint64_t pos) const {
+		assert(pos <= num_bits);
+		assert(dirty_lo >= dirty_hi && counts.size() == num_blocks() + 1 && "The rank index is not up to date");
+		const uint64_t word = pos / 64, block = word >> log2_words_per_block;
+		uint64_t result = counts[block];
+		for (uint64_t w = block * words_per_block; w < word; w++) result += nu(bits[w]);
+		if (pos % 64 != 0) result += nu(bits[word] & ((1ULL << pos % 64) - 1));
+		return result;
+	}
+
+	/** Returns the number of zeros before a given position, bringing the rank index up to date if necessary.
+	 *
+	 * @param pos a position from 0 to size() (included).
+	 */
+	uint64_t rankZero(const uint64_t pos) { return pos - rank(pos); }
+
+	/** Returns the number of zeros before a given position; update() must have been called after the last modification.
+	 *
+	 * @param pos a position from 0 to size() (included).
+	 */
+	uint64_t rankZero(const uint64_t pos) const { return pos - rank(pos); }
+
+	/** Returns the position of the one of given rank, rebuilding the selector on ones if necessary.
+	 *
+	 * @param rank a rank smaller than the number of ones.
+	 */
+	uint64_t select(const uint64_t rank) {
+		if (!select_ones_valid) {
+			select_ones = S<AT>(&bits, num_bits, bits.allocType());
+			select_ones_valid = true;
+		}
+		return select_ones.select(rank);
+	}
+
+	/** Returns the position of the one of given rank; update() must have been called after the last modification.
+	 *
+	 * @param rank a rank smaller than the number of ones.
+	 */
+	uint64_t select(const uint64_t rank) const {
+		assert(select_ones_valid && "The selector on ones is not up to date");
+		return select_ones.select(rank);
+	}
+
+	/** Returns the position of the zero of given rank, rebuilding the selector on zeros if necessary.
+	 *
+	 * @param rank a rank smaller than the number of zeros.
+	 */
+	uint64_t selectZero(const uint64_t rank) {
+		if (!select_zeros_valid) {
+			select_zeros = SZ<AT>(&bits, num_bits, bits.allocType());
+			select_zeros_valid = true;
+		}
+		return select_zeros.selectZero(rank);
+	}
+
+	/** Returns the position of the zero of given rank; update() must have been called after the last modification.
+	 *
+	 * @param rank a rank smaller than the number of zeros.
+	 */
+	uint64_t selectZero(const uint64_t rank) const {
+		assert(select_zeros_valid && "The selector on zeros is not up to date");
+		return select_zeros.selectZero(rank);
+	}
+
+	/** Returns an estimate of the size in bits of this structure, including the indices that are up to date. */
+	uint64_t bitCount() const {
+		return bits.bitCount() - sizeof(bits) * 8 + counts.bitCount() - sizeof(counts) * 8 + (select_ones_valid ? select_ones.bitCount() - sizeof(select_ones) * 8 : 0) +
+			   (select_zeros_valid ? select_zeros.bitCount() - sizeof(select_zeros) * 8 : 0) + sizeof(*this) * 8;
+	}
+
+	/** Writes the bits of a bit vector; indices are not written, and they will be rebuilt when needed. */
+	friend std::ostream &operator<<(std::ostream &out, const BitVector &bv) {
+		out.write(reinterpret_cast<const char *>(&bv.num_bits), sizeof(bv.num_bits));
+		out << bv.bits;
+		return out;
+	}
+
+	friend std::istream &operator>>(std::istream &in, BitVector &bv) {
+		in.read(reinterpret_cast<char *>(&bv.num_bits), sizeof(bv.num_bits));
+		in >> bv.bits;
+		bv.counts.size(0);
+		bv.dirty_lo = bv.dirty_hi = 0;
+		bv.select_ones_valid = bv.select_zeros_valid = false;
+		return in;
+	}
+};
+
+} // namespace sux::util
@@ -0,0 +1,81 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2019-2020 Stefano Marchini and Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace sux::util {
+
+/** Runs a sequence of staged tasks, interleaving their stages.
+ *
+ * A staged task is an object with a method `bool resume()` that runs the next
+ * stage of the task and returns true when the task is complete. Stages
+ * are expected to end by prefetching the memory read by the following stage, so
+ * that running stages of other tasks in the meanwhile hides the latency of
+ * memory accesses. This is the C++17 equivalent of a round-robin scheduler of
+ * coroutines that suspend after each prefetch.
+ *
+ * Up to `width` tasks are in flight at the same time; each complete task is
+ * immediately replaced by the next one, so tasks are started in order but might
+ * complete out of order.
+ *
+ * @param n the number of tasks.
+ * @param width the maximum number of tasks in flight (at least one).
+ * @param start a function such that `start(i)` returns task `i`, which must be of type `T`.
+ * @param finish a function that will be called as `finish(i, task)` when task `i` is complete.
+ */
+template <class T, class S, class F> void interleave(const size_t n, const size_t width, S &&start, F &&finish) {
+	const size_t num_slots = n < width ? n : width;
+	std::vector<T> slots;
+	std::vector<size_t> index(num_slots);
+	slots.reserve(num_slots);
+	size_t next = 0;
+	for (; next < num_slots; next++) {
+		slots.push_back(start(next));
+		index[next] = next;
+	}
+
+	for (size_t active = num_slots; active != 0;) {
+		for (size_t s = 0; s < num_slots; s++) {
+			if (index[s] == SIZE_MAX || !slots[s].resume()) continue;
+			finish(index[s], slots[s]);
+			if (next < n) {
+				slots[s] = start(next);
+				index[s] = next++;
+			} else {
+				index[s] = SIZE_MAX;
+				active--;
+			}
+		}
+	}
+}
+
+} // namespace sux::util
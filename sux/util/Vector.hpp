@@ -34,6 +34,9 @@
 #include <iostream>
 #include <string>
 #include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <utility>
 
 namespace sux::util {
 
@@ -54,7 +57,52 @@ enum AllocType {
 	 * In this case allocations are aligned on a huge (typically, 2MiB) memory page.
 	 * This feature is usually disabled by default and it requires the administrator
 	 * to pre-reserve space for huge memory pages as documented in the reported external references  */
-	FORCEHUGEPAGE
+	FORCEHUGEPAGE,
+	/** The type of allocation is chosen at runtime, for each instance, among the previous ones
+	 * (the default being ::MALLOC). In this way instances with different types of allocation
+	 * share the same C++ type; the only overhead is a branch on the type when memory is
+	 * allocated or freed, and not when it is accessed. */
+	DYNAMIC
+};
+
+/** Hints about the expected access pattern to the backing memory of a structure.
+ *
+ * Hints are passed to the kernel using `madvise()` and never change the content
+ * of the memory; they are silently ignored when not supported.
+ *
+ * \see https://man7.org/linux/man-pages/man2/madvise.2.html
+ */
+enum class AccessHint {
+	/** Random accesses: readahead is disabled (`MADV_RANDOM`). */
+	RANDOM,
+	/** Sequential accesses: aggressive readahead (`MADV_SEQUENTIAL`). */
+	SEQUENTIAL,
+	/** The memory will be accessed soon, and should be faulted in ahead of time (`MADV_WILLNEED`). */
+	WILLNEED,
+	/** The memory will not be accessed soon, and can be reclaimed. For
+	 * anonymous memory this is mapped to `MADV_PAGEOUT`, as `MADV_DONTNEED`
+	 * would discard the content. */
+	DONTNEED,
+	/** The memory is rarely accessed, and should be reclaimed first under pressure (`MADV_COLD`). */
+	COLD
+};
+
+// Stores the type of allocation of a Vector only when it is chosen at runtime, so that
+// for the other types it is an empty base class and takes no space
+template <AllocType AT> class AllocTypeField {
+  protected:
+	AllocTypeField(AllocType) {}
+	AllocType get_alloc_type() const { return AT; }
+	void swap_alloc_type(AllocTypeField &) {}
+};
+
+template <> class AllocTypeField<DYNAMIC> {
+	AllocType alloc_type;
+
+  protected:
+	AllocTypeField(AllocType alloc_type) : alloc_type(alloc_type) {}
+	AllocType get_alloc_type() const { return alloc_type; }
+	void swap_alloc_type(AllocTypeField &oth) { std::swap(alloc_type, oth.alloc_type); }
 };
 
 /** An expandable vector with settable type of memory allocation.
@@ -71,11 +119,19 @@ enum AllocType {
  * This class implements the standard `<<` and `>>` operators for simple
  * serialization and deserialization.
  *
+ * Alternatively, a vector can be a read-only, shared mapping of a region of
+ * a file created with map(int, off_t, size_t), or a read-only view of an
+ * existing array created with view(const T *, size_t); in these cases the allocation
+ * type is ignored, and the vector cannot be modified or resized.
+ *
+ * With allocation type ::DYNAMIC the actual type of allocation is passed at construction time
+ * and it is returned by allocType().
+ *
  * @tparam T the data type of an element.
  * @tparam AT a type of memory allocation out of ::AllocType.
  */
 
-template <typename T, AllocType AT = MALLOC> class Vector : public Expandable {
+template <typename T, AllocType AT = MALLOC> class Vector : public Expandable, private AllocTypeField<AT> {
 
 #ifndef MAP_HUGETLB
 #pragma message("Huge pages not supported")
@@ -85,36 +141,127 @@ template <typename T, AllocType AT = MALLOC> class Vector : public Expandable {
 
   public:
 	static constexpr int PROT = PROT_READ | PROT_WRITE;
-	static constexpr int FLAGS = MAP_PRIVATE | MAP_ANONYMOUS | (AT == FORCEHUGEPAGE ? MAP_HUGETLB : 0);
+	/** The default type of allocation of instances, which is ::MALLOC for ::DYNAMIC. */
+	static constexpr AllocType DEFAULT_ALLOC_TYPE = AT == DYNAMIC ? MALLOC : AT;
 
   public:
 	size_t _size = 0, _capacity = 0;
 	T *data = nullptr;
+	// Zero if the backing array is owned, BORROWED if it is borrowed from somebody else, and
+	// otherwise the length (in bytes) of the file mapping containing it, which starts at
+	// the page containing the start of the backing array
+	size_t mapping_length = 0;
+	static constexpr size_t BORROWED = SIZE_MAX;
 
   public:
-	Vector() = default;
+	Vector() : AllocTypeField<AT>(DEFAULT_ALLOC_TYPE) {}
+
+	explicit Vector(size_t length) : Vector() { size(length); }
 
-	explicit Vector(size_t length) { size(length); }
+	/** Creates an empty vector with a given type of allocation.
+	 *
+	 * @param alloc_type a type of allocation, which must be AT unless AT is ::DYNAMIC.
+	 */
+	explicit Vector(AllocType alloc_type) : AllocTypeField<AT>(alloc_type) {
+		assert((AT == DYNAMIC ? alloc_type != DYNAMIC : alloc_type == AT) && "Invalid allocation type");
+	}
 
-	explicit Vector(const T *data, size_t length) : Vector(length) { memcpy(this->data, data, length); }
+	explicit Vector(const T *data, size_t length) : Vector() {
+		sizeUninitialized(length);
+		memcpy(this->data, data, length * sizeof(T));
+	}
+
+	/** Creates a copy of a vector with a different type of memory allocation.
+	 *
+	 * The backing array is allocated without being initialized, and then filled
+	 * with the elements of the given vector. In particular, with mmap()-based allocation
+	 * types memory is touched for the first time by the copy, and thus after the
+	 * huge-page advice has been given, so transparent huge pages are used
+	 * from the start when available.
+	 *
+	 * @param oth the vector to copy, which might be a mapping or a view.
+	 * @param alloc_type the type of allocation of the copy, which must be AT unless AT is ::DYNAMIC.
+	 */
+	template <AllocType AT2> explicit Vector(const Vector<T, AT2> &oth, AllocType alloc_type = DEFAULT_ALLOC_TYPE) : Vector(alloc_type) {
+		if (oth.size() == 0) return;
+		sizeUninitialized(oth.size());
+		memcpy(data, &oth, oth.size() * sizeof(T));
+	}
 
 	~Vector() {
-		if (data) {
-			if (AT == MALLOC) {
+		if (isMapped()) {
+			if (mapping_length != BORROWED) {
+				int result = munmap(reinterpret_cast<void *>(reinterpret_cast<uintptr_t>(data) & ~uintptr_t(4095)), mapping_length);
+				assert(result == 0 && "mmunmap failed");
+			}
+		} else if (data) {
+			if (allocType() == MALLOC) {
 				free(data);
 			} else {
-				int result = munmap(data, _capacity);
+				int result = munmap(data, page_aligned(_capacity));
 				assert(result == 0 && "mmunmap failed");
 			}
 		}
 	}
 
+	/** Creates a read-only vector backed by a shared mapping of a region of a file.
+	 *
+	 * Pages are read from the file on demand and belong to the page cache, so
+	 * they can be reclaimed by the kernel under memory pressure. The vector
+	 * unmaps the region when it is destroyed.
+	 *
+	 * @param fd a file descriptor open for reading.
+	 * @param offset the offset in bytes of the region in the file (no alignment is necessary).
+	 * @param length the number of elements in the region.
+	 * @return a vector backed by the mapping, or an empty vector if the mapping failed.
+	 */
+	static Vector map(int fd, off_t offset, size_t length) {
+		Vector vector;
+		if (length == 0) return vector;
+		const off_t start = offset & ~off_t(4095);
+		const size_t mapping_length = length * sizeof(T) + (offset - start);
+		void *mem = mmap(nullptr, mapping_length, PROT_READ, MAP_SHARED, fd, start);
+		if (mem == MAP_FAILED) return vector;
+
+		vector.mapping_length = mapping_length;
+		vector.data = reinterpret_cast<T *>(static_cast<char *>(mem) + (offset - start));
+		vector._size = vector._capacity = length;
+		return vector;
+	}
+
+	/** Creates a read-only vector that borrows an existing array.
+	 *
+	 * The array is not copied and it is not freed when the vector is destroyed: it must
+	 * outlive the vector. This is useful to access serialized structures in place.
+	 *
+	 * @param data the array.
+	 * @param length the number of elements of the array.
+	 * @return a vector borrowing `data`.
+	 */
+	static Vector view(const T *data, size_t length) {
+		Vector vector;
+		if (length == 0) return vector;
+		vector.mapping_length = BORROWED;
+		vector.data = const_cast<T *>(data);
+		vector._size = vector._capacity = length;
+		return vector;
+	}
+
+	/** Returns the type of allocation of this vector, which is AT unless AT is ::DYNAMIC. */
+	AllocType allocType() const { return this->get_alloc_type(); }
+
+	/** Returns true if the backing array of this vector is not owned, that is,
+	 * if it has been created by map(int, off_t, size_t) or view(const T *, size_t). */
+	bool isMapped() const { return mapping_length != 0; }
+
 	// Delete copy operators
 	Vector(const Vector &) = delete;
 	Vector &operator=(const Vector &) = delete;
 
 	// Define move operators
-	Vector(Vector<T, AT> &&oth) : _size(std::exchange(oth._size, 0)), _capacity(std::exchange(oth._capacity, 0)), data(std::exchange(oth.data, nullptr)) {}
+	Vector(Vector<T, AT> &&oth)
+		: AllocTypeField<AT>(oth.allocType()), _size(std::exchange(oth._size, 0)), _capacity(std::exchange(oth._capacity, 0)), data(std::exchange(oth.data, nullptr)),
+		  mapping_length(std::exchange(oth.mapping_length, 0)) {}
 
 	Vector<T, AT> &operator=(Vector<T, AT> &&oth) {
 		swap(*this, oth);
@@ -142,6 +289,19 @@ template <typename T, AllocType AT = MALLOC> class Vector : public Expandable {
 		if (capacity > _capacity) remap(capacity);
 	}
 
+	/** Enlarges the backing array to that it can contain a given number of elements,
+	 * leaving new elements uninitialized.
+	 *
+	 * This method behaves like reserve(size_t), but the content of the new
+	 * elements is undefined. With mmap()-based allocation types new memory
+	 * is always zeroed by the kernel, so the two methods are equivalent.
+	 *
+	 * @param capacity the desired new capacity.
+	 */
+	void reserveUninitialized(size_t capacity) {
+		if (capacity > _capacity) remap(capacity, false);
+	}
+
 	/** Enlarges the backing array to that it can contain a given number of elements, plus possibly extra space.
 	 *
 	 * If the current capacity is sufficient, nothing happens. Otherwise, the
@@ -168,6 +328,18 @@ template <typename T, AllocType AT = MALLOC> class Vector : public Expandable {
 		_size = size;
 	}
 
+	/** Changes the vector size to the given value, leaving new elements uninitialized.
+	 *
+	 * This method behaves like resize(size_t), but the content of new
+	 * elements that required a reallocation is undefined.
+	 *
+	 * @param size the desired new size.
+	 */
+	void resizeUninitialized(size_t size) {
+		if (size > _capacity) remap(max(size, _capacity + (_capacity / 2)), false);
+		_size = size;
+	}
+
 	/** Changes the vector size and capacity to the given value.
 	 *
 	 * Both size and capacity are set to the provided size.
@@ -181,6 +353,20 @@ template <typename T, AllocType AT = MALLOC> class Vector : public Expandable {
 		trimToFit();
 	}
 
+	/** Changes the vector size and capacity to the given value, leaving new elements uninitialized.
+	 *
+	 * This method behaves like size(size_t), but the content of new
+	 * elements is undefined. It is meant to be used when the vector is
+	 * going to be entirely overwritten, e.g., by a copy or a read.
+	 *
+	 * @param size the desired new size.
+	 */
+	void sizeUninitialized(size_t size) {
+		reserveUninitialized(size);
+		_size = size;
+		trimToFit();
+	}
+
 	/** Adds a given element at the end of this vector.
 	 *
 	 * @param elem an element.
@@ -199,10 +385,26 @@ template <typename T, AllocType AT = MALLOC> class Vector : public Expandable {
 	 */
 	T popBack() { return data[--_size]; }
 
+	/** Adds the given elements at the end of this vector.
+	 *
+	 * Memory is enlarged at most once, and the new elements are
+	 * not initialized before being copied.
+	 *
+	 * @param elems a pointer to the elements.
+	 * @param count the number of elements.
+	 */
+	void append(const T *elems, size_t count) {
+		const size_t old_size = _size;
+		resizeUninitialized(_size + count);
+		memcpy(data + old_size, elems, count * sizeof(T));
+	}
+
 	friend void swap(Vector<T, AT> &first, Vector<T, AT> &second) noexcept {
 		std::swap(first._size, second._size);
 		std::swap(first._capacity, second._capacity);
 		std::swap(first.data, second.data);
+		std::swap(first.mapping_length, second.mapping_length);
+		first.swap_alloc_type(second);
 	}
 
 	/** Returns a pointer at the start of the backing array. */
@@ -230,31 +432,89 @@ template <typename T, AllocType AT = MALLOC> class Vector : public Expandable {
 	 */
 	size_t bitCount() const { return sizeof(*this) * 8 + _capacity * sizeof(T) * 8; }
 
-  private:
-	static size_t page_aligned(size_t size) {
-		if (AT == FORCEHUGEPAGE)
-			return ((2 * 1024 * 1024 - 1) | (size * sizeof(T) - 1)) + 1;
-		else
-			return ((4 * 1024 - 1) | (size * sizeof(T) - 1)) + 1;
+	/** Advises the kernel about the expected access pattern to the backing array.
+	 *
+	 * Only the pages entirely contained in the backing array are affected; with
+	 * ::FORCEHUGEPAGE allocation pages are huge pages, as `madvise()` requires.
+	 *
+	 * @param hint the expected access pattern.
+	 * @return true if the hint was accepted by the kernel.
+	 */
+	bool advise(AccessHint hint) const {
+		if (data == nullptr || _size == 0) return true;
+		// Memory we allocated with huge pages must be advised in whole huge pages
+		const uintptr_t page_mask = (isMapped() ? 4 * 1024 : page_size()) - 1;
+		const uintptr_t start = (reinterpret_cast<uintptr_t>(data) + page_mask) & ~page_mask;
+		const uintptr_t end = (reinterpret_cast<uintptr_t>(data + _size)) & ~page_mask;
+		if (start >= end) return true;
+
+		int advice;
+		switch (hint) {
+		case AccessHint::RANDOM:
+			advice = MADV_RANDOM;
+			break;
+		case AccessHint::SEQUENTIAL:
+			advice = MADV_SEQUENTIAL;
+			break;
+		case AccessHint::WILLNEED:
+			advice = MADV_WILLNEED;
+			break;
+		case AccessHint::DONTNEED:
+			if (isMapped() && mapping_length != BORROWED) {
+				// File-backed pages can be dropped and read back later
+				advice = MADV_DONTNEED;
+				break;
+			}
+#ifdef MADV_PAGEOUT
+			advice = MADV_PAGEOUT;
+			break;
+#else
+			return false;
+#endif
+		case AccessHint::COLD:
+#ifdef MADV_COLD
+			advice = MADV_COLD;
+			break;
+#else
+			return false;
+#endif
+		default:
+			return false;
+		}
+
+		return madvise(reinterpret_cast<void *>(start), end - start, advice) == 0;
 	}
 
-	void remap(size_t size) {
+  private:
+	size_t page_size() const { return allocType() == FORCEHUGEPAGE ? 2 * 1024 * 1024 : 4 * 1024; }
+
+	size_t page_aligned(size_t size) const { return ((page_size() - 1) | (size * sizeof(T) - 1)) + 1; }
+
+	void remap(size_t size, bool zero = true) {
+		assert(!isMapped() && "a mapped vector cannot be resized");
 		if (size == 0) return;
 
 		void *mem;
 		size_t space; // Space to allocate, in bytes
 
-		if (AT == MALLOC) {
+		const AllocType type = allocType();
+		if (type == MALLOC) {
 			space = size * sizeof(T);
-			mem = _capacity == 0 ? malloc(space) : realloc(data, space);
+			if (_capacity == 0) {
+				// calloc() avoids touching fresh pages obtained from the kernel
+				mem = zero ? calloc(space, 1) : malloc(space);
+				zero = false;
+			} else
+				mem = realloc(data, space);
 			assert(mem != NULL && "malloc failed");
 		} else {
+			const int flags = MAP_PRIVATE | MAP_ANONYMOUS | (type == FORCEHUGEPAGE ? MAP_HUGETLB : 0);
 			space = page_aligned(size);
 			if (_capacity == 0)
-				mem = mmap(nullptr, space, PROT, FLAGS, -1, 0);
+				mem = mmap(nullptr, space, PROT, flags, -1, 0);
 			else {
 #ifndef MREMAP_MAYMOVE
-				mem = mmap(nullptr, space, PROT, FLAGS, -1, 0);
+				mem = mmap(nullptr, space, PROT, flags, -1, 0);
 				memcpy(mem, data, page_aligned(_capacity));
 #else
 				mem = mremap(data, page_aligned(_capacity), space, MREMAP_MAYMOVE, -1, 0);
@@ -262,13 +522,16 @@ template <typename T, AllocType AT = MALLOC> class Vector : public Expandable {
 			}
 			assert(mem != MAP_FAILED && "mmap failed");
 
-			if (AT == TRANSHUGEPAGE) {
+			if (type == TRANSHUGEPAGE) {
 				int adv = madvise(mem, space, MADV_HUGEPAGE);
 				assert(adv == 0 && "madvise failed");
 			}
+
+			// Anonymous mappings (and their extensions by mremap()) are zeroed by the kernel
+			zero = false;
 		}
 
-		if (_capacity * sizeof(T) < space) memset(static_cast<char *>(mem) + _capacity * sizeof(T), 0, space - _capacity * sizeof(T));
+		if (zero && _capacity * sizeof(T) < space) memset(static_cast<char *>(mem) + _capacity * sizeof(T), 0, space - _capacity * sizeof(T));
 
 		_capacity = space / sizeof(T);
 		data = static_cast<T *>(mem);
@@ -284,7 +547,8 @@ template <typename T, AllocType AT = MALLOC> class Vector : public Expandable {
 	friend std::istream &operator>>(std::istream &is, Vector<T, AT> &vector) {
 		uint64_t nsize;
 		is.read((char *)&nsize, sizeof(uint64_t));
-		vector = Vector<T, AT>(nsize);
+		vector = Vector<T, AT>(vector.allocType());
+		vector.sizeUninitialized(nsize);
 		is.read((char *)&vector, vector.size() * sizeof(T));
 		return is;
 	}
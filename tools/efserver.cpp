@@ -0,0 +1,435 @@
+/*
+ * Sux: Succinct data structures
+ *
+ * Copyright (C) 2007-2020 Sebastiano Vigna
+ *
+ *  This library is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License as published by the Free
+ *  Software Foundation; either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation; either version 3, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT ANY
+ * WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+ * PARTICULAR PURPOSE.  See the GNU General Public License for more details.
+ *
+ * Under Section 7 of GPL version 3, you are granted additional permissions
+ * described in the GCC Runtime Library Exception, version 3.1, as published by
+ * the Free Software Foundation.
+ *
+ * You should have received a copy of the GNU General Public License and a copy of
+ * the GCC Runtime Library Exception along with this program; see the files
+ * COPYING3 and COPYING.RUNTIME respectively.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A reference query server for EliasFanoContainer files, and a load generator for it.
+ *
+ *   efserver gen CONTAINER FILTERS ELEMENTS UNIVERSE
+ *       writes a container of random filters, for testing;
+ *   efserver serve [-t THREADS] SOCKET CONTAINER
+ *       maps CONTAINER and answers queries on the Unix domain socket SOCKET until interrupted;
+ *   efserver load [-c CONNECTIONS] [-b BATCH] [-d DEPTH] [-n BATCHES] [-v] SOCKET CONTAINER
+ *       sends random batches of queries to the server over CONNECTIONS connections, keeping
+ *       at most DEPTH batches in flight on each connection, and reports throughput and latency;
+ *       with -v, answers are checked against CONTAINER.
+ *
+ * A batch is a 64-bit count n followed by n Query records; the server answers with n 64-bit
+ * results, in the same order. Batches on a connection are answered in order, so clients can
+ * pipeline them. Each server thread serves one connection at a time; within a batch, queries
+ * are run in groups whose memory is prefetched (see EliasFano::prefetch()) before any of them runs.
+ */
+
+#include <sux/bits/EliasFanoContainer.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <fcntl.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <poll.h>
+#include <random>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+using namespace sux;
+using namespace sux::bits;
+
+struct Query {
+	enum : uint32_t { POINT = 0, EMPTY = 1, COUNT = 2 };
+	/** POINT (is lo an element?), EMPTY (is [lo..hi] empty?) or COUNT (how many elements in [lo..hi]?). */
+	uint32_t op;
+	/** The index of the filter in the container. */
+	uint32_t filter;
+	uint64_t lo, hi;
+};
+
+static constexpr size_t MAX_BATCH = 1 << 20;
+static constexpr size_t GROUP = 16;
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<bool> stop(false);
+
+static bool read_fully(int fd, void *buf, size_t length) {
+	for (char *p = static_cast<char *>(buf); length != 0;) {
+		const ssize_t r = ::read(fd, p, length);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		p += r;
+		length -= r;
+	}
+	return true;
+}
+
+static bool write_fully(int fd, const void *buf, size_t length) {
+	for (const char *p = static_cast<const char *>(buf); length != 0;) {
+		const ssize_t r = ::send(fd, p, length, MSG_NOSIGNAL);
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+		p += r;
+		length -= r;
+	}
+	return true;
+}
+
+// Waits until fd is readable or stop is set; returns false in the second case
+static bool wait_readable(int fd) {
+	struct pollfd p = {fd, POLLIN, 0};
+	while (!stop) {
+		const int r = poll(&p, 1, 200);
+		if (r > 0) return true;
+		if (r < 0 && errno != EINTR) return false;
+	}
+	return false;
+}
+
+static bool open_filters(const char *path, EliasFanoContainer &container, std::vector<EliasFano<>> &filters) {
+	if (!container.open(path)) return false;
+	filters.resize(container.size());
+	for (size_t i = 0; i < container.size(); i++)
+		if (!container.view(i, filters[i], true)) return false;
+	return true;
+}
+
+static uint64_t run(const std::vector<EliasFano<>> &filters, const Query &q) {
+	if (q.filter >= filters.size()) return UINT64_MAX;
+	const EliasFano<> &ef = filters[q.filter];
+	switch (q.op) {
+	case Query::POINT:
+		return ef.contains(q.lo);
+	case Query::EMPTY:
+		if (q.lo > q.hi || ef.numOnes() == 0 || q.lo >= ef.num_bits) return 1;
+		else {
+			const auto p = ef.predecessor(min(q.hi, ef.num_bits - 1));
+			return p.index() == SIZE_MAX || *p < q.lo;
+		}
+	case Query::COUNT:
+		return q.lo > q.hi ? 0 : ef.rank(q.hi == UINT64_MAX ? UINT64_MAX : q.hi + 1) - ef.rank(q.lo);
+	default:
+		return UINT64_MAX;
+	}
+}
+
+static void run_batch(const std::vector<EliasFano<>> &filters, const Query *const queries, const size_t n, uint64_t *const results) {
+	for (size_t i = 0; i < n; i += GROUP) {
+		const size_t m = min(GROUP, n - i);
+		for (size_t j = i; j < i + m; j++)
+			if (queries[j].filter < filters.size()) filters[queries[j].filter].prefetch(queries[j].lo);
+		for (size_t j = i; j < i + m; j++) results[j] = run(filters, queries[j]);
+	}
+}
+
+static int usage() {
+	fprintf(stderr, "Usage: efserver gen CONTAINER FILTERS ELEMENTS UNIVERSE\n"
+					"       efserver serve [-t THREADS] SOCKET CONTAINER\n"
+					"       efserver load [-c CONNECTIONS] [-b BATCH] [-d DEPTH] [-n BATCHES] [-v] SOCKET CONTAINER\n");
+	return 1;
+}
+
+static int gen(int argc, char **argv) {
+	if (argc != 5) return usage();
+	const uint64_t num_filters = strtoull(argv[2], nullptr, 0), n = strtoull(argv[3], nullptr, 0), u = strtoull(argv[4], nullptr, 0);
+	if (u == 0) return usage();
+	std::ofstream out(argv[1], std::ios::binary);
+	EliasFanoContainerWriter writer(out);
+	std::mt19937_64 r(0);
+	std::vector<uint64_t> v(n);
+	for (uint64_t f = 0; f < num_filters; f++) {
+		for (auto &x : v) x = r() % u;
+		std::sort(v.begin(), v.end());
+		EliasFano<> ef(v.begin(), v.end());
+		ef.pointFilter(10);
+		writer.add(f, ef);
+	}
+	writer.finish();
+	return out ? 0 : 1;
+}
+
+static sockaddr_un address(const char *path) {
+	sockaddr_un addr = {};
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	return addr;
+}
+
+static int serve(int argc, char **argv) {
+	unsigned threads = max(1U, std::thread::hardware_concurrency());
+	for (int c; (c = getopt(argc, argv, "t:")) != -1;) {
+		if (c == 't') threads = max(1, atoi(optarg));
+		else return usage();
+	}
+	if (argc - optind != 2) return usage();
+
+	EliasFanoContainer container;
+	std::vector<EliasFano<>> filters;
+	if (!open_filters(argv[optind + 1], container, filters)) {
+		fprintf(stderr, "Cannot open container %s\n", argv[optind + 1]);
+		return 1;
+	}
+
+	const sockaddr_un addr = address(argv[optind]);
+	const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(addr.sun_path);
+	// The listener is nonblocking, as all threads poll it, but only one gets each connection
+	if (listener < 0 || bind(listener, (const sockaddr *)&addr, sizeof addr) != 0 || listen(listener, 128) != 0 || fcntl(listener, F_SETFL, O_NONBLOCK) != 0) {
+		fprintf(stderr, "Cannot listen on %s: %s\n", addr.sun_path, strerror(errno));
+		return 1;
+	}
+
+	// Signals are handled by sigwait() in this thread only
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+	std::atomic<uint64_t> num_queries(0), num_batches(0), busy_ns(0);
+	std::vector<std::thread> pool;
+	for (unsigned t = 0; t < threads; t++) {
+		pool.emplace_back([&] {
+			std::vector<Query> queries;
+			std::vector<uint64_t> results;
+			while (wait_readable(listener)) {
+				const int fd = accept(listener, nullptr, nullptr);
+				if (fd < 0) continue; // Another thread got the connection
+				for (uint64_t n; wait_readable(fd) && read_fully(fd, &n, sizeof n) && n <= MAX_BATCH;) {
+					queries.resize(n);
+					results.resize(n);
+					if (!read_fully(fd, queries.data(), n * sizeof(Query))) break;
+					const auto start = Clock::now();
+					run_batch(filters, queries.data(), n, results.data());
+					busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+					num_queries += n;
+					num_batches++;
+					if (!write_fully(fd, results.data(), n * sizeof(uint64_t))) break;
+				}
+				close(fd);
+			}
+		});
+	}
+
+	fprintf(stderr, "Serving %zu filters on %s with %u threads\n", filters.size(), addr.sun_path, threads);
+	std::thread reporter([&] {
+		uint64_t last_queries = 0;
+		auto last = Clock::now();
+		while (!stop) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			const auto now = Clock::now();
+			if (now - last < std::chrono::seconds(1)) continue;
+			const uint64_t q = num_queries;
+			if (q != last_queries)
+				fprintf(stderr, "%.0f queries/s, %.1f ns/query of service time\n", (q - last_queries) / std::chrono::duration<double>(now - last).count(), q == 0 ? 0. : double(busy_ns) / q);
+			last_queries = q;
+			last = now;
+		}
+	});
+
+	int signal;
+	sigwait(&signals, &signal);
+	stop = true;
+	for (auto &thread : pool) thread.join();
+	reporter.join();
+	close(listener);
+	unlink(addr.sun_path);
+	fprintf(stderr, "Served %lu queries in %lu batches\n", (unsigned long)num_queries.load(), (unsigned long)num_batches.load());
+	return 0;
+}
+
+// The queries of a batch are a function of the connection and of the index of the batch, so that they can be regenerated for checking
+static void make_batch(const std::vector<EliasFano<>> &filters, const uint64_t seed, std::vector<Query> &queries) {
+	std::mt19937_64 r(seed);
+	for (auto &q : queries) {
+		q.filter = r() % filters.size();
+		q.op = r() % 3;
+		const EliasFano<> &ef = filters[q.filter];
+		const uint64_t u = max(uint64_t(1), ef.num_bits);
+		// Half of the point probes are positive
+		q.lo = q.op == Query::POINT && ef.numOnes() != 0 && r() % 2 ? *ef.predecessor(r() % u) : r() % u;
+		q.hi = q.lo + r() % max(uint64_t(1), 16 * u / max(size_t(1), ef.numOnes()));
+	}
+}
+
+// A latency histogram in nanoseconds with 32 buckets per power of two, so its size does not depend on the
+// number of batches and percentiles are accurate within about 3%
+struct Histogram {
+	static constexpr int SUB_BITS = 5;
+	std::vector<uint64_t> counts = std::vector<uint64_t>(64 << SUB_BITS);
+	uint64_t total = 0, max = 0;
+
+	static size_t bucket(uint64_t ns) {
+		if (ns < (1 << SUB_BITS)) return ns;
+		const int e = 63 - __builtin_clzll(ns);
+		return size_t(e - SUB_BITS + 1) << SUB_BITS | (ns >> (e - SUB_BITS) & ((1 << SUB_BITS) - 1));
+	}
+
+	// The smallest value in a bucket
+	static uint64_t lower_bound(size_t b) {
+		if (b < (1 << SUB_BITS)) return b;
+		return (uint64_t(1) << SUB_BITS | (b & ((1 << SUB_BITS) - 1))) << ((b >> SUB_BITS) - 1);
+	}
+
+	void add(uint64_t ns) {
+		counts[bucket(ns)]++;
+		total++;
+		max = std::max(max, ns);
+	}
+
+	void merge(const Histogram &h) {
+		for (size_t b = 0; b < counts.size(); b++) counts[b] += h.counts[b];
+		total += h.total;
+		max = std::max(max, h.max);
+	}
+
+	double percentile(double p) const {
+		const uint64_t rank = min(total, uint64_t(p * total) + 1);
+		uint64_t seen = 0;
+		for (size_t b = 0; b < counts.size(); b++)
+			if ((seen += counts[b]) >= rank && counts[b] != 0) return std::min(max, lower_bound(b));
+		return 0;
+	}
+};
+
+static int load(int argc, char **argv) {
+	unsigned connections = 1;
+	size_t batch = 256, depth = 4, batches = 10000;
+	bool verify = false;
+	for (int c; (c = getopt(argc, argv, "c:b:d:n:v")) != -1;) {
+		if (c == 'c') connections = max(1, atoi(optarg));
+		else if (c == 'b') batch = min(MAX_BATCH, max(size_t(1), size_t(strtoull(optarg, nullptr, 0))));
+		else if (c == 'd') depth = max(size_t(1), size_t(strtoull(optarg, nullptr, 0)));
+		else if (c == 'n') batches = strtoull(optarg, nullptr, 0);
+		else if (c == 'v') verify = true;
+		else return usage();
+	}
+	if (argc - optind != 2) return usage();
+
+	EliasFanoContainer container;
+	std::vector<EliasFano<>> filters;
+	if (!open_filters(argv[optind + 1], container, filters) || filters.empty()) {
+		fprintf(stderr, "Cannot open container %s\n", argv[optind + 1]);
+		return 1;
+	}
+
+	const sockaddr_un addr = address(argv[optind]);
+	std::vector<Histogram> latencies(connections);
+	std::atomic<uint64_t> errors(0);
+	std::vector<std::thread> pool;
+	const auto start = Clock::now();
+
+	for (unsigned c = 0; c < connections; c++) {
+		pool.emplace_back([&, c] {
+			const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd < 0 || connect(fd, (const sockaddr *)&addr, sizeof addr) != 0) {
+				fprintf(stderr, "Cannot connect to %s: %s\n", addr.sun_path, strerror(errno));
+				errors += batches;
+				return;
+			}
+
+			// Batches are sent by a separate thread, so that sending and receiving never block each other.
+			// At most depth batches are in flight, so their sending times fit a ring of depth entries.
+			std::vector<Clock::time_point> sent(depth);
+			std::mutex mutex;
+			std::condition_variable window;
+			size_t num_received = 0;
+			bool done = false;
+			std::thread sender([&] {
+				std::vector<Query> queries(batch);
+				const uint64_t n = batch;
+				for (size_t i = 0; i < batches; i++) {
+					make_batch(filters, uint64_t(c) << 40 | i, queries);
+					{
+						std::unique_lock<std::mutex> lock(mutex);
+						// The receiver sets done when it gives up, so we never wait for answers that will not come
+						window.wait(lock, [&] { return done || i - num_received < depth; });
+						if (done) break;
+						sent[i % depth] = Clock::now();
+					}
+					if (!write_fully(fd, &n, sizeof n) || !write_fully(fd, queries.data(), n * sizeof(Query))) break;
+				}
+			});
+
+			std::vector<Query> queries(batch);
+			std::vector<uint64_t> results(batch);
+			for (size_t i = 0; i < batches; i++) {
+				if (!read_fully(fd, results.data(), batch * sizeof(uint64_t))) {
+					errors += batches - i;
+					break;
+				}
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					latencies[c].add(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent[i % depth]).count());
+					num_received = i + 1;
+				}
+				window.notify_one();
+				if (verify) {
+					make_batch(filters, uint64_t(c) << 40 | i, queries);
+					for (size_t j = 0; j < batch; j++)
+						if (results[j] != run(filters, queries[j])) errors++;
+				}
+			}
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				done = true;
+			}
+			window.notify_one();
+			shutdown(fd, SHUT_RDWR);
+			sender.join();
+			close(fd);
+		});
+	}
+
+	for (auto &thread : pool) thread.join();
+	const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	Histogram all;
+	for (const auto &l : latencies) all.merge(l);
+	printf("%lu batches of %zu queries in %.3f s: %.0f queries/s\n", (unsigned long)all.total, batch, seconds, all.total * batch / seconds);
+	printf("Batch latency (us): p50 %.1f, p99 %.1f, p99.9 %.1f, max %.1f\n", all.percentile(.5) / 1E3, all.percentile(.99) / 1E3, all.percentile(.999) / 1E3, all.max / 1E3);
+	if (errors != 0) printf("%lu errors\n", (unsigned long)errors.load());
+	return errors == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) return usage();
+	const std::string command = argv[1];
+	if (command == "gen") return gen(argc - 1, argv + 1);
+	if (command == "serve") return serve(argc - 1, argv + 1);
+	if (command == "load") return load(argc - 1, argv + 1);
+	return usage();
+}